@@ -34,6 +34,8 @@
 void COMMAND_Upload(void);
 void COMMAND_Download(void);
 void COMMAND_Jump(void);
+void COMMAND_SaveImageRecord(void);
+uint8_t COMMAND_PrecomputeInstalledCrc(void);
 void find_bin_file(const char *name);
 
 #ifdef __cplusplus
@@ -0,0 +1,40 @@
+/**
+  ******************************************************************************
+  * @file    crc_if.h
+  * @brief   Header file for crc_if.c
+  ******************************************************************************
+  * @attention
+  *
+  * This software is licensed under terms that can be found in the LICENSE file
+  * in the root directory of this software component.
+  * If no LICENSE file comes with this software, it is provided AS-IS.
+  *
+  ******************************************************************************
+  */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __CRC_IF_H
+#define __CRC_IF_H
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include "stm32f4xx_hal.h"
+
+/* Exported types ------------------------------------------------------------*/
+/* Exported constants --------------------------------------------------------*/
+/* Value of the hardware CRC after a reset, i.e. CRC of an empty buffer */
+#define CRC_IF_INITIAL_VALUE       ((uint32_t)0xFFFFFFFF)
+
+/* Exported macros -----------------------------------------------------------*/
+/* Exported functions ------------------------------------------------------- */
+void CRC_If_Reset(void);
+uint32_t CRC_If_Accumulate(const uint8_t *Data, uint32_t Length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* __CRC_IF_H */
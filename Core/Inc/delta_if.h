@@ -0,0 +1,112 @@
+/**
+  ******************************************************************************
+  * @file    delta_if.h
+  * @brief   Header file for delta_if.c
+  ******************************************************************************
+  * @attention
+  *
+  * This software is licensed under terms that can be found in the LICENSE file
+  * in the root directory of this software component.
+  * If no LICENSE file comes with this software, it is provided AS-IS.
+  *
+  ******************************************************************************
+  */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __DELTA_IF_H
+#define __DELTA_IF_H
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+
+/* Exported constants --------------------------------------------------------*/
+/* Delta file: a DELTA_HeaderTypeDef padded to a whole disk sector, then
+   the body: one DELTA_RecordTypeDef per rebuilt sector, each one followed
+   by the operations producing the sector content: a 32-bit word giving a
+   length (bit 31 set for a copy), then for a copy the offset of the source
+   bytes in the installed image, otherwise the literal bytes. Sectors
+   without a record keep their content */
+#define DELTA_MAGIC                 ((uint32_t)0x31544C44) /* "DLT1" */
+#define DELTA_OP_COPY               ((uint32_t)0x80000000)
+#define DELTA_HEADER_SIZE           ((uint32_t)512)
+
+/* Exported types ------------------------------------------------------------*/
+/* Header of a delta file */
+typedef struct
+{
+  uint32_t magic;                       /* DELTA_MAGIC */
+  uint32_t source_size;                 /* Size of the installed image */
+  uint32_t source_crc;                  /* CRC of the installed image */
+  uint32_t target_size;                 /* Size of the resulting image */
+  uint32_t target_crc;                  /* CRC of the resulting image */
+  uint32_t records;                     /* Number of rebuilt sectors */
+  uint32_t body_crc;                    /* CRC of the file from DELTA_HEADER_SIZE */
+} DELTA_HeaderTypeDef;
+
+/* Sector rebuilt by a delta */
+typedef struct
+{
+  uint32_t offset;                      /* Sector start, from the image base */
+  uint32_t length;                      /* Bytes produced, the rest is erased */
+} DELTA_RecordTypeDef;
+
+/* Result of DELTA_If_Apply */
+typedef enum
+{
+  DELTA_OK = 0,
+  DELTA_ERROR_READ,                     /* The body could not be read */
+  DELTA_ERROR_FORMAT,                   /* Record or operation out of bounds */
+  DELTA_ERROR_FLASH                     /* Erase or program error */
+} DELTA_StatusTypeDef;
+
+/* Flash and file operations the delta is applied through: FLASH_If, the
+   CRC unit and the image file on the target, models on the host */
+typedef struct
+{
+  /* Reads the next bytes of the body, 0: read error */
+  uint8_t (*Read)(void *Buff, uint32_t Size);
+  /* Erases the sector holding an address, 0: done */
+  uint32_t (*Erase)(uint32_t Address);
+  /* Programs a buffer like FLASH_If_WriteBuffer, 0: done */
+  uint32_t (*Program)(uint32_t Address, const uint8_t *Data, uint32_t Length);
+  /* Returns the base address of the sector following an address */
+  uint32_t (*NextSector)(uint32_t Address);
+  /* Returns a pointer on the content of a flash address */
+  const uint8_t *(*Map)(uint32_t Address);
+  /* Adds the next bytes of the resulting image to its CRC */
+  void (*Accumulate)(const uint8_t *Data, uint32_t Length);
+} DELTA_SinkTypeDef;
+
+/* Delta being applied */
+typedef struct
+{
+  const DELTA_SinkTypeDef *Sink;
+  uint32_t ImageBase;                   /* Address the image is rebuilt at */
+  uint32_t ImageSize;                   /* Size of the resulting image */
+  uint32_t SourceBase;                  /* Address of the installed image */
+  uint32_t SourceSize;                  /* Size of the installed image */
+  uint32_t Records;                     /* Records left in the body */
+  uint32_t SpareAddress;                /* Staging sector, used when the
+                                           installed image is rebuilt in
+                                           place */
+  uint8_t *Window;                      /* RAM window */
+  uint32_t WindowSize;                  /* Size of the window, a multiple of
+                                           ProgramUnit */
+  uint32_t ProgramUnit;                 /* Bytes per program operation */
+  uint32_t Fill;                        /* Bytes held in the window */
+  uint32_t Address;                     /* Sector being rebuilt */
+} DELTA_HandleTypeDef;
+
+/* Exported macros -----------------------------------------------------------*/
+/* Exported functions ------------------------------------------------------- */
+DELTA_StatusTypeDef DELTA_If_Apply(DELTA_HandleTypeDef *hdelta, uint32_t *Programmed);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* __DELTA_IF_H */
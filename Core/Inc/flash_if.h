@@ -39,6 +39,32 @@ Note: the 1st and the second sectors 0x08000000-0x0800BFFF are reserved
 for the Firmware upgrade code */
 #define APPLICATION_ADDRESS        (uint32_t)0x0800C000
 
+/* 1: two application slots over the 128 KB sectors. A new image is written
+   to the slot not booted and the boot selector is switched once the image
+   is verified, so the running application stays bootable until then. Each
+   slot runs an image linked at its own address */
+#ifndef DUAL_SLOT
+#define DUAL_SLOT                  0
+#endif
+
+/* Slot A: sectors 5-7, slot B: sectors 8-10 */
+#define SLOT_A_ADDRESS             ADDR_FLASH_SECTOR_5
+#define SLOT_B_ADDRESS             ADDR_FLASH_SECTOR_8
+#define SLOT_SIZE                  (SLOT_B_ADDRESS - SLOT_A_ADDRESS)
+
+/* Boot selector: two logs of tags, in sectors 3 and 4. A log starts with a
+   header holding a generation number and its complement; the valid header
+   with the later generation designates the log in use. Each switch
+   programs the next erased unit of that log and its last valid tag wins.
+   A full log goes on in the other sector, erased first, whose header is
+   programmed after its first tag. Without a valid log slot A boots */
+#define SLOT_SELECTOR_ADDRESS      ADDR_FLASH_SECTOR_3
+#define SLOT_SELECTOR_ALT_ADDRESS  ADDR_FLASH_SECTOR_4
+#define SLOT_SELECTOR_SIZE         ((uint32_t)0x4000)
+#define SLOT_SELECTOR_HEADER_SIZE  ((uint32_t)8)
+#define SLOT_TAG_A                 ((uint32_t)0x41544C53) /* "SLTA" */
+#define SLOT_TAG_B                 ((uint32_t)0x42544C53) /* "SLTB" */
+
 /* Exported constants --------------------------------------------------------*/
 /* This value can be equal to (512 * x) according to RAM size availability with x=[1, 128]
    In this project x is fixed to 64 => 512 * 64 = 32768bytes = 32 Kbytes */
@@ -47,8 +73,21 @@ for the Firmware upgrade code */
 // add to front at main() of app
 // NVIC_SetVectorTable (NVIC_VectTab_FLASH, 0xc000);
 // SCB->VTOR = 0x0800c000;
+// with DUAL_SLOT: SCB->VTOR = 0x08020000 (slot A) or 0x08080000 (slot B)
 // __enable_irq();
 
+/* Flash program/erase parallelism, must match the supply voltage:
+   FLASH_VOLTAGE_RANGE_1: 1.8V to 2.1V, x8
+   FLASH_VOLTAGE_RANGE_2: 2.1V to 2.7V, x16
+   FLASH_VOLTAGE_RANGE_3: 2.7V to 3.6V, x32
+   FLASH_VOLTAGE_RANGE_4: 2.7V to 3.6V + External Vpp, x64 */
+#ifndef FLASH_IF_VOLTAGE_RANGE
+#define FLASH_IF_VOLTAGE_RANGE     FLASH_VOLTAGE_RANGE_3
+#endif
+
+/* Bytes written per program operation for the selected range */
+#define FLASH_IF_PROGRAM_UNIT      ((uint32_t)1 << FLASH_IF_VOLTAGE_RANGE)
+
 /* Last Page Address */
 #define USER_FLASH_LAST_PAGE_ADDRESS  0x080FFFFF - 4
 
@@ -88,7 +127,17 @@ for the Firmware upgrade code */
 void FLASH_If_FlashUnlock(void);
 FlagStatus FLASH_If_ReadOutProtectionStatus(void);
 uint32_t FLASH_If_EraseSectors(uint32_t Address);
+uint32_t FLASH_If_EraseSector(uint32_t Address);
+uint32_t FLASH_If_GetSectorNumber(uint32_t Address);
+uint32_t FLASH_If_GetNextSectorAddress(uint32_t Address);
+uint32_t FLASH_If_GetProgrammedEnd(uint32_t Address, uint32_t Length);
 uint32_t FLASH_If_Write(uint32_t Address, uint32_t Data);
+uint32_t FLASH_If_WriteBuffer(uint32_t Address, const uint8_t *Data, uint32_t Length);
+uint32_t FLASH_If_GetBootAddress(void);
+uint32_t FLASH_If_GetUpdateAddress(void);
+#if (DUAL_SLOT == 1)
+uint32_t FLASH_If_SelectSlot(uint32_t Address);
+#endif
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,36 @@
+/**
+  ******************************************************************************
+  * @file    lz4_if.h
+  * @brief   Header file for lz4_if.c
+  ******************************************************************************
+  * @attention
+  *
+  * This software is licensed under terms that can be found in the LICENSE file
+  * in the root directory of this software component.
+  * If no LICENSE file comes with this software, it is provided AS-IS.
+  *
+  ******************************************************************************
+  */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __LZ4_IF_H
+#define __LZ4_IF_H
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+
+/* Exported types ------------------------------------------------------------*/
+/* Exported constants --------------------------------------------------------*/
+/* Exported macros -----------------------------------------------------------*/
+/* Exported functions ------------------------------------------------------- */
+uint32_t LZ4_If_DecodeBlock(const uint8_t *Src, uint32_t SrcLength, uint8_t *Dst, uint32_t DstLength);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* __LZ4_IF_H */
@@ -0,0 +1,82 @@
+/**
+  ******************************************************************************
+  * @file    trace_if.h
+  * @brief   Header file for trace_if.c
+  ******************************************************************************
+  * @attention
+  *
+  * This software is licensed under terms that can be found in the LICENSE file
+  * in the root directory of this software component.
+  * If no LICENSE file comes with this software, it is provided AS-IS.
+  *
+  ******************************************************************************
+  */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __TRACE_IF_H
+#define __TRACE_IF_H
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include "stm32f4xx_hal.h"
+
+/* Exported types ------------------------------------------------------------*/
+/* Bootloader phases, in the order they normally occur */
+typedef enum
+{
+  TRACE_RESET = 0,                      /* main() entered */
+  TRACE_CLOCK_READY,                    /* Update path clock configured */
+  TRACE_USB_INIT,                       /* MX_USB_HOST_Init returned */
+  TRACE_USB_ATTACH,                     /* Device pulled up a data line */
+  TRACE_USB_RESET,                      /* Port reset started */
+  TRACE_USB_PORT_ENABLED,               /* Port reset completed */
+  TRACE_USB_CONNECT,                    /* Device attached, reset recovery over */
+  TRACE_USB_CLASS_ACTIVE,               /* MSC class ready */
+  TRACE_USB_DISCONNECT,                 /* Device removed */
+  TRACE_MOUNT,                          /* f_mount returned */
+  TRACE_FIND_FILE,                      /* Image lookup done, arg: 1 found */
+  TRACE_ERASE,                          /* Sector erased, arg: sector number */
+  TRACE_PROGRAM_DONE,                   /* Image programmed, arg: Kbytes */
+  TRACE_VERIFY_DONE,                    /* CRC check done, arg: 0 passed */
+  TRACE_IDLE_TIMEOUT,                   /* No device: boot decision, arg: tick */
+  TRACE_JUMP,                           /* Leaving for the application */
+  TRACE_EVENT_COUNT
+} TRACE_EventTypeDef;
+
+/* Exported constants --------------------------------------------------------*/
+/* 1: phase events are recorded, 0: TRACE_POINT compiles to nothing */
+#ifndef BOOT_TRACE
+#define BOOT_TRACE                 1
+#endif
+
+/* Number of events kept, the oldest ones are overwritten (power of 2) */
+#ifndef TRACE_IF_DEPTH
+#define TRACE_IF_DEPTH             32U
+#endif
+
+/* 1: the timeline is printed before jumping to the application, which
+   delays the boot by the console time (a few ms per event at 115200 baud) */
+#ifndef TRACE_IF_DUMP_ON_JUMP
+#define TRACE_IF_DUMP_ON_JUMP      0
+#endif
+
+/* Exported macros -----------------------------------------------------------*/
+#if (BOOT_TRACE == 1)
+#define TRACE_POINT(event, arg)    TRACE_If_Record((event), (arg))
+#else
+#define TRACE_POINT(event, arg)
+#endif
+
+/* Exported functions ------------------------------------------------------- */
+void TRACE_If_Init(void);
+void TRACE_If_Record(TRACE_EventTypeDef Event, uint32_t Arg);
+void TRACE_If_Dump(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* __TRACE_IF_H */
@@ -17,23 +17,194 @@
   */
 /* Includes ------------------------------------------------------------------ */
 #include "main.h"
+#include "command.h"
 #include "flash_if.h"
+#include "crc_if.h"
+#include "trace_if.h"
+#include "lz4_if.h"
+#include "delta_if.h"
 #include "usb_host.h"
 #include "fatfs.h"
 #include "stdint.h"
 
-/* Private typedef ----------------------------------------------------------- */
 /* Private defines ----------------------------------------------------------- */
 #define UPLOAD_FILENAME            "0:UPLOAD.bin"
+#if (DUAL_SLOT == 1)
+/* Each slot runs an image linked at its own address: the file is the one
+   built for the slot being programmed */
+#define DOWNLOAD_FILENAME          ((ImageBase == SLOT_B_ADDRESS) ? "tm_img_b.bin" : "tm_img_a.bin")
+#define FILENAME_TO_FIND            ((ImageBase == SLOT_B_ADDRESS) ? "TM_IMG_B.BIN" : "TM_IMG_A.BIN")
+/* Largest image: one slot */
+#define IMAGE_MAX_SIZE              SLOT_SIZE
+#else
 #define DOWNLOAD_FILENAME          "tm_image.bin"
 #define FILENAME_TO_FIND            "TM_IMAGE.BIN"
+#define IMAGE_MAX_SIZE              USER_FLASH_SIZE
+#endif
+
+/* Number of bytes programmed on each MSC idle poll while the next chunk is
+   being transferred: small enough to keep the BOT state machine serviced */
+#define PROGRAM_SLICE_SIZE          ((uint32_t)64)
+
+/* 1: sectors whose content already matches the image are left untouched */
+#ifndef DIFFERENTIAL_UPDATE
+#define DIFFERENTIAL_UPDATE         1
+#endif
+
+/* Optional image trailer: the last 8 bytes of the file hold this marker
+   followed by the CRC of the image (see crc_if.c), the trailer itself is
+   neither programmed nor included in the CRC */
+#define IMAGE_TRAILER_MAGIC         ((uint32_t)0x21435243) /* "CRC!" */
+#define IMAGE_TRAILER_SIZE          ((uint32_t)8)
+
+/* UPLOAD.bin layout:
+   0: plain image of the user area, cut after the last programmed word
+   1: sparse container, an UPLOAD_HeaderTypeDef followed by the extent table
+      and the data of each extent, erased sectors are left out */
+#ifndef UPLOAD_SPARSE
+#define UPLOAD_SPARSE               0
+#endif
+#define UPLOAD_SPARSE_MAGIC         ((uint32_t)0x53525053) /* "SPRS" */
+/* Sectors 3 to 11 of the user area */
+#define UPLOAD_MAX_EXTENTS          9
+
+/* Entries of the cluster link map of the image file: room for 7 fragments */
+#define LINKMAP_SIZE                16
+
+/* Compressed image: an LZ_HeaderTypeDef followed by blocks, each one a
+   32-bit word giving the size of its data (bit 31 set when the data is
+   stored as is) and the data. A block decodes to block_size bytes, the last
+   one to the rest of the image. Blocks are independent LZ4 blocks */
+#define LZ_IMAGE_MAGIC              ((uint32_t)0x49345A4C) /* "LZ4I" */
+#define LZ_BLOCK_STORED             ((uint32_t)0x80000000)
+/* Largest block size accepted, a power of 2 dividing BUFFER_SIZE */
+#define LZ_MAX_BLOCK_SIZE           ((uint32_t)16384)
+/* Compressed input: a whole block with its size word, plus the slack that
+   lets every refill end on a disk sector boundary */
+#define LZ_INPUT_SIZE               (LZ_MAX_BLOCK_SIZE + 4 + _MAX_SS)
+
+/* Optional image header: an IMAGE_HeaderTypeDef ahead of a plain image,
+   not programmed. It is padded to a whole disk sector so that the image
+   starts on a sector boundary and takes the raw multi-sector path */
+#define IMAGE_HEADER_MAGIC          ((uint32_t)0x48474D49) /* "IMGH" */
+#define IMAGE_HEADER_SIZE           ((uint32_t)512)
+/* Record of the installed image, kept in sector 2 below the boot flag */
+#define IMAGE_RECORD_MAGIC          ((uint32_t)0x43455249) /* "IREC" */
+#define IMAGE_RECORD_ADDRESS        ((uint32_t)0x0800BFEC)
+/* Bytes of the installed image added to its CRC on each main loop pass */
+#define INSTALLED_CRC_SLICE         ((uint32_t)8192)
+
+/* 1: the image file may be a delta against the installed application */
+#ifndef DELTA_UPDATE
+#define DELTA_UPDATE                1
+#endif
+/* Sectors larger than the RAM window are staged in this spare sector, which
+   neither image may reach. With DUAL_SLOT the image is rebuilt in the other
+   slot and needs no staging */
+#ifndef DELTA_SPARE_ADDRESS
+#define DELTA_SPARE_ADDRESS         ADDR_FLASH_SECTOR_11
+#endif
+/* RAM window: both program buffers */
+#define DELTA_WINDOW_SIZE           ((uint32_t)2 * BUFFER_SIZE)
+
+/* Private typedef ----------------------------------------------------------- */
+/* Populated flash area written to UPLOAD.bin */
+typedef struct
+{
+  uint32_t address;
+  uint32_t length;
+} UPLOAD_ExtentTypeDef;
+
+/* Header of the sparse UPLOAD.bin */
+typedef struct
+{
+  uint32_t magic;                       /* UPLOAD_SPARSE_MAGIC */
+  uint32_t count;                       /* Number of extents in the table */
+} UPLOAD_HeaderTypeDef;
+
+/* Header of a compressed image */
+typedef struct
+{
+  uint32_t magic;                       /* LZ_IMAGE_MAGIC */
+  uint32_t size;                        /* Size of the decoded image */
+  uint32_t crc;                         /* CRC of the decoded image */
+  uint32_t block_size;                  /* Decoded size of a block */
+} LZ_HeaderTypeDef;
+
+/* Image header and record of the installed image */
+typedef struct
+{
+  uint32_t magic;                       /* IMAGE_HEADER_MAGIC or IMAGE_RECORD_MAGIC */
+  uint32_t version;                     /* Application version, 0 if unknown */
+  uint32_t length;                      /* Size of the image */
+  uint32_t crc;                         /* CRC of the image */
+} IMAGE_HeaderTypeDef;
+
+/* Progress of the CRC of the installed image */
+typedef enum
+{
+  INSTALLED_CRC_IDLE = 0,               /* Not started */
+  INSTALLED_CRC_BUSY,                   /* Computed slice by slice */
+  INSTALLED_CRC_READY,                  /* InstalledCrc is valid */
+  INSTALLED_CRC_NONE                    /* No record of the installed image */
+} INSTALLED_CrcStateTypeDef;
+
+/* Chunk handed over to the flash programmer */
+typedef struct
+{
+  uint32_t src;                         /* RAM address of the next word */
+  uint32_t dst;                         /* Flash address of the next word */
+  uint32_t remain;                      /* Bytes still to be programmed */
+} PROGRAM_JobTypeDef;
 
 /* Private macros ------------------------------------------------------------ */
 /* Private variables --------------------------------------------------------- */
 static uint32_t TmpReadSize = 0x00;
 static uint32_t RamAddress = 0x00;
 static __IO uint32_t LastPGAddress = APPLICATION_ADDRESS;
-static uint8_t RAM_Buf[BUFFER_SIZE] = { 0x00 };
+/* First address not erased yet: sectors are erased just ahead of the
+   programming cursor */
+static uint32_t EraseAddress = APPLICATION_ADDRESS;
+/* Flash address the image is programmed at: APPLICATION_ADDRESS, or the slot
+   not booted with DUAL_SLOT */
+static uint32_t ImageBase = APPLICATION_ADDRESS;
+/* Ping-pong buffers: one is programmed while the other is filled over USB */
+static uint8_t RAM_Buf[2][BUFFER_SIZE] __ALIGNED(4) = { 0x00 };
+static PROGRAM_JobTypeDef ProgramJob;
+/* Size of the image to program, without the optional trailer */
+static uint32_t ImageSize = 0x00;
+/* CRC of the image data as read from the USB disk */
+static uint32_t StreamCrc = CRC_IF_INITIAL_VALUE;
+/* File offset of the image data: the size of the optional image header */
+static uint32_t ImageOffset = 0x00;
+/* Record programmed again after the boot flag sector is erased: the one of
+   the installed image, or of the image just programmed */
+static IMAGE_HeaderTypeDef ImageRecord;
+/* CRC of the installed image, computed from the main loop while the stick
+   enumerates: the image covered, the bytes done so far and the result. The
+   CRC unit belongs to this computation until it is ready */
+static INSTALLED_CrcStateTypeDef InstalledCrcState = INSTALLED_CRC_IDLE;
+static uint32_t InstalledAddress = 0x00;
+static uint32_t InstalledLength = 0x00;
+static uint32_t InstalledDone = 0x00;
+static uint32_t InstalledCrc = CRC_IF_INITIAL_VALUE;
+/* Cluster link map of the image file (FatFs fast seek) */
+static DWORD LinkMap[LINKMAP_SIZE];
+/* First disk sector of the image file when it is contiguous, 0 otherwise */
+static DWORD ImageSector = 0x00;
+/* Compressed image: block size (0 for a plain image), input buffer with
+   its read and fill positions, and number of bytes decoded so far */
+static uint32_t LzBlockSize = 0x00;
+static uint8_t LzInput[LZ_INPUT_SIZE] __ALIGNED(4);
+static uint32_t LzInPos = 0x00;
+static uint32_t LzInLen = 0x00;
+static uint32_t LzDecoded = 0x00;
+#if (DELTA_UPDATE == 1)
+/* Delta file: set when the image file is a delta, and the delta to apply.
+   Its installed image is ImageBase, or the booted slot with DUAL_SLOT */
+static uint8_t DeltaImage = 0x00;
+static DELTA_HandleTypeDef DeltaHandle;
+#endif
 
 FATFS USBH_fatfs;
 FIL up_load_file;                     /* File object for upload operation */
@@ -43,24 +214,57 @@ extern ApplicationTypeDef Appli_state;
 extern USBH_HandleTypeDef hUsbHostFS;
 
 /* Private function prototypes ----------------------------------------------- */
+static uint32_t COMMAND_ScanExtents(UPLOAD_ExtentTypeDef *extent);
+static uint8_t COMMAND_UploadRange(uint32_t Address, uint32_t size);
 static void COMMAND_ProgramFlashMemory(void);
+static uint32_t COMMAND_ProgramRange(uint32_t Address, uint32_t size);
+#if (DIFFERENTIAL_UPDATE == 1)
+static uint8_t COMMAND_IsRangeUnchanged(uint32_t Address, uint32_t size);
+#endif
+static void COMMAND_ProgramSlice(uint32_t size);
+static void COMMAND_EraseRange(uint32_t Address, uint32_t end);
+static void COMMAND_EraseSector(uint32_t Address);
+static uint8_t COMMAND_ReadTrailer(uint32_t *crc);
+static uint8_t COMMAND_ReadLzHeader(uint32_t *crc);
+static uint8_t COMMAND_ReadImageHeader(uint32_t *crc, uint32_t *version);
+static uint8_t COMMAND_IsInstalled(uint32_t size, uint32_t crc);
+static uint32_t COMMAND_GetInstalledCrc(uint32_t size);
+#if (DELTA_UPDATE == 1)
+static uint8_t COMMAND_ReadDeltaHeader(uint32_t *crc);
+static uint32_t COMMAND_ApplyDelta(void);
+static uint8_t COMMAND_ReadDelta(void *buff, uint32_t size);
+static uint32_t COMMAND_EraseDelta(uint32_t Address);
+static const uint8_t *COMMAND_MapFlash(uint32_t Address);
+static void COMMAND_AccumulateDelta(const uint8_t *Data, uint32_t Length);
+#endif
+static void COMMAND_ProbeContiguous(void);
+static FRESULT COMMAND_ReadFile(void *buff, uint32_t size, uint32_t *bytesread);
+static FRESULT COMMAND_ReadImage(void *buff, uint32_t size, uint32_t *bytesread);
+static void COMMAND_ReadChunk(void *buff, uint32_t size, uint32_t *bytesread);
+static FRESULT COMMAND_ReadLzBlocks(uint8_t *buff, uint32_t size, uint32_t *bytesread);
+static uint8_t COMMAND_FillLzInput(uint32_t needed);
+static uint32_t COMMAND_VerifyFlashMemory(uint8_t trailer, uint32_t crc);
 void find_bin_file(const char *name);
-FRESULT find_file(const TCHAR* path, const TCHAR* ext, TCHAR* foundFile);
 
 /* Private functions --------------------------------------------------------- */
 
 /**
   * @brief  IAP Read all flash memory.
+  * @note   Erased flash is not dumped: depending on UPLOAD_SPARSE the file
+  *         stops after the last programmed word or only carries the
+  *         populated extents.
   * @param  None
   * @retval None
   */
 void COMMAND_Upload(void)
 {
-  __IO uint32_t address = APPLICATION_ADDRESS;
-  __IO uint32_t counterread = 0x00;
-  uint32_t tmpcounter = 0x00, indexoffset = 0x00;
   FlagStatus readoutstatus = SET;
-  uint16_t byteswritten;
+  UPLOAD_ExtentTypeDef extent[UPLOAD_MAX_EXTENTS];
+  uint32_t count;
+#if (UPLOAD_SPARSE == 1)
+  UPLOAD_HeaderTypeDef header;
+  uint32_t index;
+#endif
 
   /* Get the read out protection status */
   readoutstatus = FLASH_If_ReadOutProtectionStatus();
@@ -69,41 +273,37 @@ void COMMAND_Upload(void)
     /* Remove UPLOAD file if it exists on flash disk */
     f_unlink(UPLOAD_FILENAME);
 
-    /* Init written byte counter */
-    indexoffset = (APPLICATION_ADDRESS - USER_FLASH_STARTADDRESS);
+    /* Locate the programmed areas */
+    count = COMMAND_ScanExtents(extent);
 
     /* Open binary file to write on it */
     if ((Appli_state == APPLICATION_READY) &&
         (f_open(&up_load_file, UPLOAD_FILENAME, FA_CREATE_ALWAYS | FA_WRITE) ==
          FR_OK))
     {
+#if (UPLOAD_SPARSE == 1)
+      header.magic = UPLOAD_SPARSE_MAGIC;
+      header.count = count;
 
-      /* Read flash memory */
-      while ((indexoffset < USER_FLASH_SIZE) &&
-             (Appli_state == APPLICATION_READY))
+      if ((COMMAND_UploadRange((uint32_t)&header, sizeof(header)) == 0) &&
+          (COMMAND_UploadRange((uint32_t)extent, count * sizeof(extent[0])) == 0))
       {
-        for (counterread = 0; counterread < BUFFER_SIZE; counterread++)
+        for (index = 0; index < count; index++)
         {
-          /* Check the read bytes versus the end of flash */
-          if (indexoffset + counterread < USER_FLASH_SIZE)
-          {
-            tmpcounter = counterread;
-            RAM_Buf[tmpcounter] = (*(uint8_t *) (address++));
-          }
-          /* In this case all flash was read */
-          else
+          if (COMMAND_UploadRange(extent[index].address, extent[index].length) != 0)
           {
             break;
           }
         }
-
-        /* Write buffer to file */
-        f_write(&up_load_file, RAM_Buf, BUFFER_SIZE, (void *)&byteswritten);
-
-        /* Number of byte written */
-        indexoffset = indexoffset + counterread;
       }
-
+#else
+      /* Everything up to the end of the last extent */
+      if (count != 0)
+      {
+        COMMAND_UploadRange(APPLICATION_ADDRESS,
+                            extent[count - 1].address + extent[count - 1].length - APPLICATION_ADDRESS);
+      }
+#endif
 
       /* Close file and filesystem */
       f_close(&up_load_file);
@@ -117,6 +317,74 @@ void COMMAND_Upload(void)
   }
 }
 
+/**
+  * @brief  Builds the list of programmed areas of the user flash.
+  * @note   Sectors are checked one by one, contiguous programmed sectors are
+  *         merged and each extent stops after its last programmed word.
+  * @param  extent: Table of UPLOAD_MAX_EXTENTS entries to fill
+  * @retval Number of extents
+  */
+static uint32_t COMMAND_ScanExtents(UPLOAD_ExtentTypeDef *extent)
+{
+  uint32_t address = APPLICATION_ADDRESS;
+  uint32_t end = APPLICATION_ADDRESS + USER_FLASH_SIZE;
+  uint32_t next;
+  uint32_t used;
+  uint32_t count = 0;
+
+  while (address < end)
+  {
+    next = MIN(FLASH_If_GetNextSectorAddress(address), end);
+    used = FLASH_If_GetProgrammedEnd(address, next - address);
+
+    if (used != address)
+    {
+      if ((count == 0) ||
+          (extent[count - 1].address + extent[count - 1].length != address))
+      {
+        /* Previous sector erased or partly used: start a new extent */
+        extent[count].address = address;
+        count++;
+      }
+      extent[count - 1].length = used - extent[count - 1].address;
+    }
+    address = next;
+  }
+
+  return count;
+}
+
+/**
+  * @brief  Appends a memory area to UPLOAD.bin.
+  * @note   The flash is memory-mapped, so it is handed to f_write directly:
+  *         whole disk sectors go from flash to the USB disk without a copy.
+  * @param  Address: Start address of the area
+  * @param  size: Number of bytes
+  * @retval 0: area written, 1: write error or disk removed
+  */
+static uint8_t COMMAND_UploadRange(uint32_t Address, uint32_t size)
+{
+  uint32_t chunk;
+  uint32_t byteswritten;
+
+  while ((size > 0) &&
+         (Appli_state == APPLICATION_READY))
+  {
+    chunk = MIN(size, BUFFER_SIZE);
+
+    if ((f_write(&up_load_file, (const void *)Address, chunk, (void *)&byteswritten) != FR_OK) ||
+        (byteswritten != chunk))
+    {
+      return (1);
+    }
+
+    Address += chunk;
+    size -= chunk;
+  }
+
+  return (size != 0) ? 1 : 0;
+}
+
 /**
   * @brief  IAP Write Flash memory.
   * @param  None
@@ -124,40 +392,148 @@ void COMMAND_Upload(void)
   */
 void COMMAND_Download(void)
 {
-  char file_name[13] = {0};
+  FRESULT res;
+  uint8_t trailer;
+  uint32_t trailer_crc = 0x00;
+  uint32_t version = 0x00;
 
-  find_file("", ".bin", file_name);
+  /* The CRC unit is needed from here on: complete the CRC of the installed
+   * image if enumeration was too short for it */
+  while (COMMAND_PrecomputeInstalledCrc() != 0)
+  {
+  }
 
-  if (strcmp(file_name, FILENAME_TO_FIND) == 0) {
-    printf("find .bin file:%s\n", file_name);
-  } else {
+  /* Keep the record of the installed image across the boot flag erase */
+  memcpy(&ImageRecord, (const void *)IMAGE_RECORD_ADDRESS, sizeof(ImageRecord));
+
+  /* With DUAL_SLOT the booted slot is left untouched */
+  ImageBase = FLASH_If_GetUpdateAddress();
+
+  /* The lookup is the one of f_open: each directory entry is compared with
+   * the packed 8.3 name and the scan stops at the first match */
+  res = f_open(&down_load_file, DOWNLOAD_FILENAME, FA_OPEN_EXISTING | FA_READ);
+  TRACE_POINT(TRACE_FIND_FILE, res == FR_OK);
+
+  if (res == FR_OK) {
+    printf("find .bin file:%s\n", FILENAME_TO_FIND);
+  } else if (res == FR_NO_FILE) {
     printf("no bin file\n");
     return;
   }
-  
-  /* Open the binary file to be downloaded */
-  if (f_open(&down_load_file, DOWNLOAD_FILENAME, FA_OPEN_EXISTING | FA_READ) == FR_OK)
+
+  /* Download the opened binary file */
+  if (res == FR_OK)
   {
-    if (f_size(&down_load_file) > USER_FLASH_SIZE)
+    /* A delta, a compressed image or an image header carries the size and
+     * CRC of the image, otherwise the optional CRC trailer is stripped from
+     * the image */
+    ImageSize = f_size(&down_load_file);
+    ImageOffset = 0x00;
+    trailer = 0;
+
+    /* Before any read of this file: the headers already go through
+     * COMMAND_ReadFile, which must not use the run of a previous file */
+    COMMAND_ProbeContiguous();
+
+#if (DELTA_UPDATE == 1)
+    trailer = COMMAND_ReadDeltaHeader(&trailer_crc);
+#endif
+    if (trailer == 0)
+    {
+      trailer = COMMAND_ReadImageHeader(&trailer_crc, &version);
+    }
+    if (trailer == 0)
+    {
+      trailer = COMMAND_ReadLzHeader(&trailer_crc);
+    }
+    if (trailer == 0)
+    {
+      trailer = COMMAND_ReadTrailer(&trailer_crc);
+    }
+
+    if (ImageSize > IMAGE_MAX_SIZE)
     {
       Fail_Handler();
     }
+    else if ((trailer != 0) && (COMMAND_IsInstalled(ImageSize, trailer_crc) != 0))
+    {
+      /* Same image as the installed one: nothing to erase or program */
+      printf("image already installed\n");
+      f_close(&down_load_file);
+    }
+#if (DUAL_SLOT == 1)
+    else if ((version != 0) && (ImageRecord.version == version) &&
+             (ImageRecord.length <= IMAGE_MAX_SIZE) &&
+             (COMMAND_IsInstalled(ImageRecord.length, ImageRecord.crc) != 0))
+    {
+      /* Same version, built for the other slot, as the booted one. The file
+       * is linked for the other slot, so its CRC cannot match the flash:
+       * the booted slot is checked against its own record instead */
+      printf("image already installed\n");
+      f_close(&down_load_file);
+    }
+#endif
     else
     {
-      /* Erase FLASH sectors to download image */
-      if (FLASH_If_EraseSectors(APPLICATION_ADDRESS) != 0x00)
+      /* Only the sectors covered by the image are erased, each one when the
+       * programming cursor reaches it */
+      EraseAddress = ImageBase;
+      if (ImageSize != 0)
       {
-        Erase_Fail_Handler();
-      } else {
-        printf("erase ok\n");
+        printf("erase sectors %lu-%lu\n", FLASH_If_GetSectorNumber(ImageBase),
+               FLASH_If_GetSectorNumber(ImageBase + ImageSize - 1));
       }
 
       /* Program flash memory */
       COMMAND_ProgramFlashMemory();
 
+      /* Check the programmed image before the boot flag gets cleared */
+      if (COMMAND_VerifyFlashMemory(trailer, trailer_crc) != 0x00)
+      {
+        TRACE_POINT(TRACE_VERIFY_DONE, 1);
+        printf("verify failed\n");
+#if (BOOT_TRACE == 1)
+        TRACE_If_Dump();
+#endif
+        Fail_Handler();
+      }
+
+      TRACE_POINT(TRACE_VERIFY_DONE, 0);
+
+#if (DUAL_SLOT == 1)
+      /* The reset handler must lie in the slot the image was programmed to */
+      if ((*(__IO uint32_t *)(ImageBase + 4) - ImageBase) >= SLOT_SIZE)
+      {
+        printf("image not linked for %08lx\n", ImageBase);
+        Fail_Handler();
+      }
+
+      /* Switchover: up to this word the previous slot is booted */
+      if (FLASH_If_SelectSlot(ImageBase) != 0x00)
+      {
+        Fail_Handler();
+      }
+      printf("boot slot %08lx\n", ImageBase);
+#endif
+
+      /* Record saved once the boot flag is cleared */
+      ImageRecord.magic = IMAGE_RECORD_MAGIC;
+      ImageRecord.version = version;
+      ImageRecord.length = ImageSize;
+      ImageRecord.crc = StreamCrc;
+
+      /* The verified image is the installed one now */
+      InstalledAddress = ImageBase;
+      InstalledLength = ImageSize;
+      InstalledCrc = StreamCrc;
+      InstalledCrcState = INSTALLED_CRC_READY;
+
       /* Close file */
       f_close(&down_load_file);
       printf("pragrammed done\n");
+#if (BOOT_TRACE == 1)
+      TRACE_If_Dump();
+#endif
 
       for (int i = 0; i < 3; i++) {
         HAL_GPIO_WritePin(GPIOB, GPIO_PIN_3, GPIO_PIN_SET);
@@ -185,120 +561,901 @@ void COMMAND_Jump(void)
   NVIC_SystemReset();
 }
 
+/**
+  * @brief  Adds a slice of the installed image to its CRC.
+  * @note   To be called from the main loop: the image described by the
+  *         record is hashed while the stick enumerates, so checking a file
+  *         against it costs no time in COMMAND_Download.
+  * @param  None
+  * @retval 1 while slices remain to be hashed, 0 once the CRC is known
+  */
+uint8_t COMMAND_PrecomputeInstalledCrc(void)
+{
+  const IMAGE_HeaderTypeDef *record = (const IMAGE_HeaderTypeDef *)IMAGE_RECORD_ADDRESS;
+  uint32_t size;
+
+  switch (InstalledCrcState)
+  {
+    case INSTALLED_CRC_IDLE:
+      if ((record->magic != IMAGE_RECORD_MAGIC) || (record->length > IMAGE_MAX_SIZE))
+      {
+        InstalledCrcState = INSTALLED_CRC_NONE;
+        break;
+      }
+      InstalledAddress = FLASH_If_GetBootAddress();
+      InstalledLength = record->length;
+      InstalledDone = 0x00;
+      CRC_If_Reset();
+      InstalledCrcState = INSTALLED_CRC_BUSY;
+      break;
+
+    case INSTALLED_CRC_BUSY:
+      size = MIN(INSTALLED_CRC_SLICE, InstalledLength - InstalledDone);
+      InstalledCrc = CRC_If_Accumulate((const uint8_t *)(InstalledAddress + InstalledDone), size);
+      InstalledDone += size;
+      if (InstalledDone == InstalledLength)
+      {
+        InstalledCrcState = INSTALLED_CRC_READY;
+      }
+      break;
+
+    default:
+      break;
+  }
+
+  return ((InstalledCrcState == INSTALLED_CRC_IDLE) || (InstalledCrcState == INSTALLED_CRC_BUSY)) ? 1 : 0;
+}
+
+/**
+  * @brief  Programs the record of the installed image.
+  * @note   To be called after the boot flag sector is erased, which also
+  *         erases the record.
+  * @param  None
+  * @retval None
+  */
+void COMMAND_SaveImageRecord(void)
+{
+  if (ImageRecord.magic == IMAGE_RECORD_MAGIC)
+  {
+    FLASH_If_WriteBuffer(IMAGE_RECORD_ADDRESS, (const uint8_t *)&ImageRecord, sizeof(ImageRecord));
+  }
+}
+
 /**
   * @brief  Programs the internal Flash memory.
+  * @note   With DIFFERENTIAL_UPDATE a plain image is handled sector by
+  *         sector and the sectors already holding the same data are skipped.
   * @param  None
   * @retval None
   */
 static void COMMAND_ProgramFlashMemory(void)
+{
+  uint32_t total_size = 0x00;
+#if (DIFFERENTIAL_UPDATE == 1)
+  uint32_t address = ImageBase;
+  uint32_t image_end = ImageBase + ImageSize;
+  uint32_t sector_end;
+  uint32_t skipped = 0x00;
+#endif
+
+  /* The CRC of the file data is computed in file order */
+  CRC_If_Reset();
+  StreamCrc = CRC_IF_INITIAL_VALUE;
+
+#if (DELTA_UPDATE == 1)
+  if (DeltaImage != 0)
+  {
+    /* Only the sectors listed by the delta are rebuilt */
+    total_size = COMMAND_ApplyDelta();
+  }
+  else
+#endif
+  if (LzBlockSize != 0)
+  {
+    /* A compressed stream cannot be entered at a sector boundary: the whole
+     * image is decoded and programmed */
+    total_size = COMMAND_ProgramRange(ImageBase, ImageSize);
+  }
+  else
+  {
+#if (DIFFERENTIAL_UPDATE == 1)
+    while (address < image_end)
+    {
+      sector_end = FLASH_If_GetNextSectorAddress(address);
+      if (sector_end > image_end)
+      {
+        sector_end = image_end;
+      }
+
+      if (COMMAND_IsRangeUnchanged(address, sector_end - address))
+      {
+        /* Same bytes as the file: the flash stands in for the file data */
+        StreamCrc = CRC_If_Accumulate((const uint8_t *)address, sector_end - address);
+        skipped++;
+      }
+      else
+      {
+        /* Rewind to the start of the sector and program it */
+        f_lseek(&down_load_file, ImageOffset + address - ImageBase);
+        total_size += COMMAND_ProgramRange(address, sector_end - address);
+      }
+      address = sector_end;
+    }
+
+    printf("unchanged sectors=%lu\n", skipped);
+#else
+    total_size = COMMAND_ProgramRange(ImageBase, ImageSize);
+#endif
+  }
+
+  printf("write bytes=%lu\n", total_size);
+  TRACE_POINT(TRACE_PROGRAM_DONE, total_size / 1024);
+}
+
+/**
+  * @brief  Programs a range of flash from the current file position.
+  * @note   The file is streamed through two buffers: while one chunk is
+  *         transferred over USB, the previous one is programmed from the
+  *         MSC idle callback, so an update costs about max(read, program)
+  *         instead of read + program.
+  * @param  Address: Flash address of the first byte
+  * @param  size: Number of bytes to program
+  * @retval Number of bytes programmed
+  */
+static uint32_t COMMAND_ProgramRange(uint32_t Address, uint32_t size)
 {
   uint32_t total_size = 0x00;
   uint8_t readflag = TRUE;
+  uint8_t bufindex = 0;
   uint32_t bytesread;
 
-  /* RAM Address Initialization */
-  RamAddress = (uint32_t)&RAM_Buf;
-
   /* Erase address init */
-  LastPGAddress = APPLICATION_ADDRESS;
+  LastPGAddress = Address;
+  ProgramJob.remain = 0;
+
+  /* Fill the first buffer: nothing to overlap with yet */
+  COMMAND_ReadChunk(RAM_Buf[bufindex], MIN(size, BUFFER_SIZE), &bytesread);
 
   /* While file still contain data */
   while ((readflag == TRUE))
   {
-    /* Read maximum 512 Kbyte from the selected file */
-    f_read(&down_load_file, RAM_Buf, BUFFER_SIZE, (void *)&bytesread);
-
     /* Temp variable */
     TmpReadSize = bytesread;
     total_size += bytesread;
 
-    /* The read data < "BUFFER_SIZE" Kbyte */
-    if (TmpReadSize < BUFFER_SIZE)
+    /* The range is complete */
+    if (total_size >= size)
     {
       readflag = FALSE;
-    }
 
-    /* Program flash memory */
-    for (uint32_t i = 0; i < TmpReadSize; i += 4)
-    {
-      /* Write word into flash memory */
-      if (FLASH_If_Write((LastPGAddress + i), *(uint32_t *)(RamAddress + i)) != 0x00)
+      /* Pad the last program unit with the erased value */
+      if ((TmpReadSize % FLASH_IF_PROGRAM_UNIT) != 0)
       {
-        /* Flash programming error: Turn LED3 On and Toggle LED4 in infinite
-         * loop */
-        // BSP_LED_On(LED3);
-        Fail_Handler();
+        memset(&RAM_Buf[bufindex][TmpReadSize], 0xFF,
+               FLASH_IF_PROGRAM_UNIT - (TmpReadSize % FLASH_IF_PROGRAM_UNIT));
       }
     }
+
+    StreamCrc = CRC_If_Accumulate(RAM_Buf[bufindex], TmpReadSize);
+
+    /* Hand the filled buffer over to the programmer */
+    RamAddress = (uint32_t)RAM_Buf[bufindex];
+    ProgramJob.src = RamAddress;
+    ProgramJob.dst = LastPGAddress;
+    ProgramJob.remain = TmpReadSize;
+
     /* Update last programmed address value */
     LastPGAddress += TmpReadSize;
+
+    /* The sectors of the job are erased now, with no transfer in flight:
+     * an erase stalls every flash fetch, the USB interrupt included */
+    COMMAND_EraseRange(ProgramJob.dst, LastPGAddress);
+
+    if (readflag == TRUE)
+    {
+      /* Read the next chunk into the other buffer, the job above is
+       * programmed slice by slice while the transfer is in flight */
+      bufindex ^= 1U;
+      COMMAND_ReadChunk(RAM_Buf[bufindex], MIN(size - total_size, BUFFER_SIZE), &bytesread);
+    }
+
+    /* Program what the transfer left over before reusing the buffer */
+    COMMAND_ProgramSlice(ProgramJob.remain);
   }
 
-  printf("write bytes=%lu\n", total_size);
+  return total_size;
 }
 
-void find_bin_file(const char *name)
+#if (DIFFERENTIAL_UPDATE == 1)
+/**
+  * @brief  Compares the next bytes of the file against the flash content.
+  * @note   Stops reading at the first difference; the file position is then
+  *         left inside the range.
+  * @param  Address: Flash address matching the current file position
+  * @param  size: Number of bytes to compare
+  * @retval 1: the flash already holds this data, 0: otherwise
+  */
+static uint8_t COMMAND_IsRangeUnchanged(uint32_t Address, uint32_t size)
 {
-    FRESULT fr;     /* Return value */
-    DIR dj;         /* Directory search object */
-    FILINFO fno;    /* File information */
+  uint32_t bytesread;
+  uint32_t chunk;
 
-    fr = f_findfirst(&dj, &fno, "", name);  /* Start to search for photo files */
+  while (size > 0)
+  {
+    chunk = MIN(size, BUFFER_SIZE);
+    if ((COMMAND_ReadFile(RAM_Buf[0], chunk, &bytesread) != FR_OK) ||
+        (bytesread != chunk) ||
+        (memcmp(RAM_Buf[0], (const void *)Address, chunk) != 0))
+    {
+      return 0;
+    }
+    Address += chunk;
+    size -= chunk;
+  }
 
-    while (fr == FR_OK && fno.fname[0]) {         /* Repeat while an item is found */
-        printf("%s\n", fno.fname);                /* Display the object name */
-        fr = f_findnext(&dj, &fno);               /* Search for next item */
+  return 1;
+}
+#endif /* DIFFERENTIAL_UPDATE == 1 */
+
+/**
+  * @brief  Programs the next bytes of the pending flash job.
+  * @param  size: Maximum number of bytes to program
+  * @retval None
+  */
+static void COMMAND_ProgramSlice(uint32_t size)
+{
+  if (size > ProgramJob.remain)
+  {
+    size = ProgramJob.remain;
+  }
+  ProgramJob.remain -= size;
+
+  if (size == 0)
+  {
+    return;
+  }
+
+  /* The job lies in sectors erased by COMMAND_EraseRange */
+  if (FLASH_If_WriteBuffer(ProgramJob.dst, (const uint8_t *)ProgramJob.src, size) != 0x00)
+  {
+    /* Flash programming error: Turn LED3 On and Toggle LED4 in infinite
+     * loop */
+    // BSP_LED_On(LED3);
+    Fail_Handler();
+  }
+  ProgramJob.src += size;
+  ProgramJob.dst += size;
+}
+
+/**
+  * @brief  Erases the sectors of an area that are not erased yet.
+  * @note   Called before the read that overlaps the programming of the
+  *         area, never from the MSC idle callback. Sectors below the area
+  *         may have been skipped as unchanged and are left as they are.
+  * @param  Address: Start address of the area to program
+  * @param  end: End address of the area
+  * @retval None
+  */
+static void COMMAND_EraseRange(uint32_t Address, uint32_t end)
+{
+  if ((Address < end) && (Address >= EraseAddress))
+  {
+    COMMAND_EraseSector(Address);
+  }
+
+  while (EraseAddress < end)
+  {
+    COMMAND_EraseSector(EraseAddress);
+  }
+}
+
+/**
+  * @brief  Erases the sector containing an address and moves the erase
+  *         cursor to the next sector.
+  * @param  Address: Address inside the sector to erase
+  * @retval None
+  */
+static void COMMAND_EraseSector(uint32_t Address)
+{
+  if (FLASH_If_EraseSector(Address) != 0x00)
+  {
+    Erase_Fail_Handler();
+  }
+  TRACE_POINT(TRACE_ERASE, FLASH_If_GetSectorNumber(Address));
+  EraseAddress = FLASH_If_GetNextSectorAddress(Address);
+}
+
+/**
+  * @brief  Reads the optional CRC trailer at the end of the file.
+  * @note   ImageSize is reduced by the trailer size when one is found and
+  *         the file position is rewound to the start of the image.
+  * @param  crc: Receives the image CRC carried by the trailer
+  * @retval 1: a trailer was found, 0: otherwise
+  */
+static uint8_t COMMAND_ReadTrailer(uint32_t *crc)
+{
+  uint32_t trailer[2];
+  uint32_t bytesread;
+  uint8_t found = 0;
+
+  if ((ImageSize >= IMAGE_TRAILER_SIZE) &&
+      (f_lseek(&down_load_file, ImageSize - IMAGE_TRAILER_SIZE) == FR_OK) &&
+      (f_read(&down_load_file, trailer, IMAGE_TRAILER_SIZE, (void *)&bytesread) == FR_OK) &&
+      (bytesread == IMAGE_TRAILER_SIZE) &&
+      (trailer[0] == IMAGE_TRAILER_MAGIC))
+  {
+    *crc = trailer[1];
+    ImageSize -= IMAGE_TRAILER_SIZE;
+    found = 1;
+  }
+
+  f_lseek(&down_load_file, 0);
+
+  return found;
+}
+
+/**
+  * @brief  Reads the optional image header.
+  * @note   When one is found, ImageSize becomes the size it gives and the
+  *         file position is left on the image. Otherwise the file position
+  *         is rewound.
+  * @param  crc: Receives the CRC of the image
+  * @param  version: Receives the version of the image
+  * @retval 1: header found, 0: otherwise
+  */
+static uint8_t COMMAND_ReadImageHeader(uint32_t *crc, uint32_t *version)
+{
+  IMAGE_HeaderTypeDef header;
+  uint32_t bytesread;
+
+  if ((f_read(&down_load_file, &header, sizeof(header), (void *)&bytesread) != FR_OK) ||
+      (bytesread != sizeof(header)) ||
+      (header.magic != IMAGE_HEADER_MAGIC))
+  {
+    f_lseek(&down_load_file, 0);
+    return 0;
+  }
+
+  if ((ImageSize < IMAGE_HEADER_SIZE) || (header.length > ImageSize - IMAGE_HEADER_SIZE))
+  {
+    printf("image shorter than its header says\n");
+    Fail_Handler();
+  }
+
+  /* The image starts on the next disk sector */
+  f_lseek(&down_load_file, IMAGE_HEADER_SIZE);
+  ImageOffset = IMAGE_HEADER_SIZE;
+  ImageSize = header.length;
+  *crc = header.crc;
+  *version = header.version;
+  printf("image version %08lx, installed %08lx\n", header.version,
+         (ImageRecord.magic == IMAGE_RECORD_MAGIC) ? ImageRecord.version : 0);
+
+  return 1;
+}
+
+/**
+  * @brief  Tells whether an image is the one already installed.
+  * @note   The record of the installed image rules out a different image
+  *         without reading the flash. A match is confirmed with the CRC of
+  *         the flash, so an application loaded by other means is never
+  *         taken for the new one.
+  * @param  size: Size of the image
+  * @param  crc: CRC of the image
+  * @retval 1: installed, 0: otherwise
+  */
+static uint8_t COMMAND_IsInstalled(uint32_t size, uint32_t crc)
+{
+  if ((ImageRecord.magic != IMAGE_RECORD_MAGIC) ||
+      (ImageRecord.length != size) || (ImageRecord.crc != crc))
+  {
+    return 0;
+  }
+
+  return (COMMAND_GetInstalledCrc(size) == crc) ? 1 : 0;
+}
+
+/**
+  * @brief  Returns the CRC of the first bytes of the installed image.
+  * @note   The CRC computed from the main loop is used when it covers the
+  *         same bytes, otherwise the flash is read now.
+  * @param  size: Number of bytes
+  * @retval CRC of the flash from the boot address
+  */
+static uint32_t COMMAND_GetInstalledCrc(uint32_t size)
+{
+  if ((InstalledCrcState == INSTALLED_CRC_READY) && (InstalledLength == size) &&
+      (InstalledAddress == FLASH_If_GetBootAddress()))
+  {
+    return InstalledCrc;
+  }
+
+  CRC_If_Reset();
+  return CRC_If_Accumulate((const uint8_t *)FLASH_If_GetBootAddress(), size);
+}
+
+/**
+  * @brief  Reads the header of a compressed image.
+  * @note   When one is found, ImageSize becomes the decoded size and the
+  *         file position is left on the first block. Otherwise the file
+  *         position is rewound to the start of the image.
+  * @param  crc: Receives the CRC of the decoded image
+  * @retval 1: compressed image, 0: plain image
+  */
+static uint8_t COMMAND_ReadLzHeader(uint32_t *crc)
+{
+  LZ_HeaderTypeDef header;
+  uint32_t bytesread;
+
+  LzBlockSize = 0x00;
+  LzInPos = 0x00;
+  LzInLen = 0x00;
+  LzDecoded = 0x00;
+
+  if ((f_read(&down_load_file, &header, sizeof(header), (void *)&bytesread) != FR_OK) ||
+      (bytesread != sizeof(header)) ||
+      (header.magic != LZ_IMAGE_MAGIC))
+  {
+    /* Plain image: starts with the initial stack pointer */
+    f_lseek(&down_load_file, 0);
+    return 0;
+  }
+
+  /* The block size must divide the program buffers */
+  if ((header.block_size < _MAX_SS) || (header.block_size > LZ_MAX_BLOCK_SIZE) ||
+      ((header.block_size & (header.block_size - 1)) != 0))
+  {
+    printf("bad block size %lu\n", header.block_size);
+    Fail_Handler();
+  }
+
+  LzBlockSize = header.block_size;
+  ImageSize = header.size;
+  *crc = header.crc;
+  printf("compressed image %lu->%lu bytes\n", (uint32_t)f_size(&down_load_file), ImageSize);
+
+  return 1;
+}
+
+#if (DELTA_UPDATE == 1)
+/**
+  * @brief  Reads the header of a delta file and checks that it applies.
+  * @note   The installed image must match the source of the delta and the
+  *         whole file its CRC before anything gets erased: a delta for
+  *         another version ends in Fail_Handler with the flash untouched.
+  *         When a delta is found, ImageSize becomes the size of the
+  *         resulting image and the file position is left on the first
+  *         record. Otherwise the file position is rewound.
+  * @param  crc: Receives the CRC of the resulting image
+  * @retval 1: delta file, 0: image file
+  */
+static uint8_t COMMAND_ReadDeltaHeader(uint32_t *crc)
+{
+  DELTA_HeaderTypeDef header;
+  uint32_t bytesread;
+  uint32_t body_crc = CRC_IF_INITIAL_VALUE;
+
+  DeltaImage = 0x00;
+
+  if ((f_read(&down_load_file, &header, sizeof(header), (void *)&bytesread) != FR_OK) ||
+      (bytesread != sizeof(header)) ||
+      (header.magic != DELTA_MAGIC))
+  {
+    f_lseek(&down_load_file, 0);
+    return 0;
+  }
+
+  DeltaHandle.SourceBase = FLASH_If_GetBootAddress();
+#if (DUAL_SLOT == 1)
+  if ((header.source_size > SLOT_SIZE) || (header.target_size > SLOT_SIZE))
+  {
+    printf("delta larger than a slot\n");
+    Fail_Handler();
+  }
+#else
+  if ((header.source_size > DELTA_SPARE_ADDRESS - APPLICATION_ADDRESS) ||
+      (header.target_size > DELTA_SPARE_ADDRESS - APPLICATION_ADDRESS))
+  {
+    printf("delta reaches the spare sector\n");
+    Fail_Handler();
+  }
+#endif
+
+  /* Nothing to check when the delta was already applied */
+  if (COMMAND_IsInstalled(header.target_size, header.target_crc) != 0)
+  {
+    ImageSize = header.target_size;
+    *crc = header.target_crc;
+    return 1;
+  }
+
+  if (COMMAND_GetInstalledCrc(header.source_size) != header.source_crc)
+  {
+    printf("delta base mismatch\n");
+    Fail_Handler();
+  }
+
+  /* The body starts on the next disk sector */
+  f_lseek(&down_load_file, DELTA_HEADER_SIZE);
+  CRC_If_Reset();
+  do
+  {
+    COMMAND_ReadFile(RAM_Buf[0], BUFFER_SIZE, &bytesread);
+    body_crc = CRC_If_Accumulate(RAM_Buf[0], bytesread);
+  } while (bytesread == BUFFER_SIZE);
+
+  if (body_crc != header.body_crc)
+  {
+    printf("delta crc mismatch\n");
+    Fail_Handler();
+  }
+  f_lseek(&down_load_file, DELTA_HEADER_SIZE);
+
+  DeltaImage = 0x01;
+  DeltaHandle.Records = header.records;
+  DeltaHandle.SourceSize = header.source_size;
+  ImageSize = header.target_size;
+  *crc = header.target_crc;
+  printf("delta %lu->%lu bytes, %lu sectors\n", header.source_size, ImageSize, header.records);
+
+  return 1;
+}
+
+/**
+  * @brief  Applies a delta file to the installed image.
+  * @note   The rebuild itself is done by delta_if.c through the flash, CRC
+  *         and file operations below; an error ends in Fail_Handler.
+  * @param  None
+  * @retval Number of bytes programmed
+  */
+static uint32_t COMMAND_ApplyDelta(void)
+{
+  static const DELTA_SinkTypeDef sink =
+  {
+    COMMAND_ReadDelta,
+    COMMAND_EraseDelta,
+    FLASH_If_WriteBuffer,
+    FLASH_If_GetNextSectorAddress,
+    COMMAND_MapFlash,
+    COMMAND_AccumulateDelta
+  };
+  DELTA_StatusTypeDef status;
+  uint32_t total_size = 0x00;
+
+  /* Sectors larger than the RAM window (both program buffers) are staged in
+   * the spare sector */
+  DeltaHandle.Sink = &sink;
+  DeltaHandle.ImageBase = ImageBase;
+  DeltaHandle.ImageSize = ImageSize;
+  DeltaHandle.SpareAddress = DELTA_SPARE_ADDRESS;
+  DeltaHandle.Window = (uint8_t *)RAM_Buf;
+  DeltaHandle.WindowSize = DELTA_WINDOW_SIZE;
+  DeltaHandle.ProgramUnit = FLASH_IF_PROGRAM_UNIT;
+
+  status = DELTA_If_Apply(&DeltaHandle, &total_size);
+  if (status != DELTA_OK)
+  {
+    printf("delta error %d at %08lx\n", status, DeltaHandle.Address);
+    Fail_Handler();
+  }
+
+  return total_size;
+}
+
+/**
+  * @brief  Reads the next bytes of a delta file.
+  * @note   The file CRC was checked up front, so a short read means the
+  *         disk went away.
+  * @param  buff: Destination buffer
+  * @param  size: Number of bytes to read
+  * @retval 1: all bytes read, 0: read error
+  */
+static uint8_t COMMAND_ReadDelta(void *buff, uint32_t size)
+{
+  uint32_t bytesread;
+
+  return ((COMMAND_ReadFile(buff, size, &bytesread) == FR_OK) && (bytesread == size)) ? 1 : 0;
+}
+
+/**
+  * @brief  Erases a sector for the delta engine.
+  * @note   An erase error ends in Erase_Fail_Handler like the other erases.
+  * @param  Address: Address inside the sector to erase
+  * @retval 0: Erase done
+  */
+static uint32_t COMMAND_EraseDelta(uint32_t Address)
+{
+  COMMAND_EraseSector(Address);
+
+  return 0x00;
+}
+
+/**
+  * @brief  Returns a pointer on a flash address: the flash is memory mapped.
+  * @param  Address: Flash address
+  * @retval Pointer on the flash content
+  */
+static const uint8_t *COMMAND_MapFlash(uint32_t Address)
+{
+  return (const uint8_t *)Address;
+}
+
+/**
+  * @brief  Adds bytes of the rebuilt image to the image CRC.
+  * @param  Data: Bytes of the image, in address order
+  * @param  Length: Number of bytes
+  * @retval None
+  */
+static void COMMAND_AccumulateDelta(const uint8_t *Data, uint32_t Length)
+{
+  StreamCrc = CRC_If_Accumulate(Data, Length);
+}
+#endif /* DELTA_UPDATE == 1 */
+
+/**
+  * @brief  Builds the cluster link map of the image file and finds out
+  *         whether the file is stored in one piece.
+  * @note   The link map also makes the f_lseek calls of the differential
+  *         update free of FAT accesses.
+  * @param  None
+  * @retval None
+  */
+static void COMMAND_ProbeContiguous(void)
+{
+  FATFS *fs = down_load_file.obj.fs;
+
+  ImageSector = 0x00;
+  LinkMap[0] = LINKMAP_SIZE;
+  down_load_file.cltbl = LinkMap;
+
+  if (f_lseek(&down_load_file, CREATE_LINKMAP) != FR_OK)
+  {
+    /* Too fragmented for the table: back to FAT chain walks */
+    down_load_file.cltbl = NULL;
+  }
+  else if ((f_size(&down_load_file) != 0) && (LinkMap[0] == 4))
+  {
+    /* One fragment: LinkMap[1] clusters starting at cluster LinkMap[2] */
+    ImageSector = fs->database + (LinkMap[2] - 2) * fs->csize;
+    printf("contiguous image at sector %lu\n", ImageSector);
+  }
+}
+
+/**
+  * @brief  Reads the next bytes of the image file.
+  * @note   When the file is contiguous, the whole sectors are read from the
+  *         disk in a single request, without FatFs splitting it at cluster
+  *         boundaries.
+  * @param  buff: Destination buffer
+  * @param  size: Number of bytes to read
+  * @param  bytesread: Receives the number of bytes read
+  * @retval FatFs result
+  */
+static FRESULT COMMAND_ReadFile(void *buff, uint32_t size, uint32_t *bytesread)
+{
+  FATFS *fs = down_load_file.obj.fs;
+  FSIZE_t fptr = f_tell(&down_load_file);
+  uint32_t count = 0x00;
+  uint32_t tail;
+  FRESULT res = FR_OK;
+
+  if ((ImageSector != 0) && ((fptr % _MAX_SS) == 0))
+  {
+    count = MIN(size, f_size(&down_load_file) - fptr) / _MAX_SS;
+  }
+
+  if (count != 0)
+  {
+    if (disk_read(fs->drv, buff, ImageSector + (fptr / _MAX_SS), count) != RES_OK)
+    {
+      *bytesread = 0;
+      return FR_DISK_ERR;
     }
 
-    f_closedir(&dj);
+    /* Move the file pointer past the raw read, the link map spares the FAT */
+    count *= _MAX_SS;
+    res = f_lseek(&down_load_file, fptr + count);
+  }
+
+  /* Partial last sector, or the file is fragmented */
+  *bytesread = count;
+  if ((res == FR_OK) && (size > count))
+  {
+    res = f_read(&down_load_file, (uint8_t *)buff + count, size - count, (void *)&tail);
+    *bytesread += tail;
+  }
+
+  return res;
 }
 
-FRESULT find_file(const TCHAR* path, const TCHAR* ext, TCHAR* foundFile)
+/**
+  * @brief  Reads the next bytes of the image, decoding them when the file
+  *         is compressed.
+  * @param  buff: Destination buffer
+  * @param  size: Number of bytes to read
+  * @param  bytesread: Receives the number of bytes read
+  * @retval FatFs result
+  */
+static FRESULT COMMAND_ReadImage(void *buff, uint32_t size, uint32_t *bytesread)
+{
+  if (LzBlockSize != 0)
+  {
+    return COMMAND_ReadLzBlocks(buff, size, bytesread);
+  }
+
+  return COMMAND_ReadFile(buff, size, bytesread);
+}
+
+/**
+  * @brief  Reads the next chunk of the range being programmed.
+  * @note   The range lies within the image, so a short read means a read
+  *         error or a removed disk: it ends in Fail_Handler at once rather
+  *         than in a CRC mismatch once a partial image is programmed.
+  * @param  buff: Destination buffer
+  * @param  size: Number of bytes to read
+  * @param  bytesread: Receives the number of bytes read, size
+  * @retval None
+  */
+static void COMMAND_ReadChunk(void *buff, uint32_t size, uint32_t *bytesread)
 {
-  DIR dir;
-  FILINFO fileInfo;
   FRESULT res;
-  int len=0;
-  // Open directory
-  res = f_opendir(&dir, path);
-  if (res != FR_OK) {
-      return res;
+
+  res = COMMAND_ReadImage(buff, size, bytesread);
+  if ((res != FR_OK) || (*bytesread != size))
+  {
+    printf("image read error %d, %lu/%lu bytes\n", res, *bytesread, size);
+    Fail_Handler();
   }
+}
 
-  // Traverse directory
-  while (1) {
-      // Read directory entry
-      res = f_readdir(&dir, &fileInfo);
-      if (res != FR_OK || fileInfo.fname[0] == 0) {
-          // End of directory or error, break loop
-          break;
-      }
+/**
+  * @brief  Decodes the next blocks of a compressed image.
+  * @note   size is a multiple of the block size or the rest of the image,
+  *         so blocks are always decoded whole into the destination. A
+  *         corrupt block ends in Fail_Handler.
+  * @param  buff: Destination buffer
+  * @param  size: Number of bytes to decode
+  * @param  bytesread: Receives the number of bytes decoded
+  * @retval FatFs result
+  */
+static FRESULT COMMAND_ReadLzBlocks(uint8_t *buff, uint32_t size, uint32_t *bytesread)
+{
+  uint32_t word;
+  uint32_t length;
+  uint32_t expected;
 
-      // Ignore hidden files and directories
-      if (fileInfo.fattrib & AM_HID) {
-          continue;
-      }
-      // printf("%s;%d;\n",fileInfo.fname,strlen(fileInfo.fname));
-      // printf("%s;%d;\n",fileInfo.fname,sizeof(fileInfo.fname));
-      
-      // Check file extension
-      //if (fileInfo.fattrib & AM_ARC && strcmp(fileInfo.fname + strlen(fileInfo.fname) - 3, ext) == 0) 
-      len = strlen(fileInfo.fname);
-      if (len >= 4 && strcasecmp(fileInfo.fname + len - 4, ext) == 0)         
+  *bytesread = 0;
+
+  while ((*bytesread < size) && (LzDecoded < ImageSize))
+  {
+    expected = MIN(LzBlockSize, ImageSize - LzDecoded);
+    if ((expected > size - *bytesread) || (COMMAND_FillLzInput(4) == 0))
+    {
+      return FR_INT_ERR;
+    }
+
+    memcpy(&word, &LzInput[LzInPos], 4);
+    length = word & ~LZ_BLOCK_STORED;
+    if ((length > LZ_MAX_BLOCK_SIZE) || (COMMAND_FillLzInput(4 + length) == 0))
+    {
+      return FR_INT_ERR;
+    }
+    LzInPos += 4;
+
+    if ((word & LZ_BLOCK_STORED) != 0)
+    {
+      if (length != expected)
       {
-          // Print file name
-          printf("%s\r\n", fileInfo.fname);
-          strncpy(foundFile, fileInfo.fname, sizeof(fileInfo.fname));
-          foundFile[sizeof(fileInfo.fname) - 1] = '\0';        
+        printf("bad stored block at %lu\n", LzDecoded);
+        Fail_Handler();
       }
-  }
+      memcpy(&buff[*bytesread], &LzInput[LzInPos], length);
+    }
+    else if (LZ4_If_DecodeBlock(&LzInput[LzInPos], length, &buff[*bytesread], expected) != expected)
+    {
+      printf("bad lz4 block at %lu\n", LzDecoded);
+      Fail_Handler();
+    }
 
-  // Close directory
-  f_closedir(&dir);
+    LzInPos += length;
+    LzDecoded += expected;
+    *bytesread += expected;
+  }
 
   return FR_OK;
 }
 
+/**
+  * @brief  Makes sure the compressed input holds the next bytes of the file.
+  * @note   Unread bytes are moved to the start of the input and the rest is
+  *         refilled in one read, which ends on a disk sector boundary so the
+  *         next refill can use the raw multi-sector path.
+  * @param  needed: Number of bytes needed from the read position
+  * @retval 1: bytes available, 0: end of file or read error
+  */
+static uint8_t COMMAND_FillLzInput(uint32_t needed)
+{
+  uint32_t space;
+  uint32_t bytesread;
+
+  if ((LzInLen - LzInPos) >= needed)
+  {
+    return 1;
+  }
+
+  memmove(LzInput, &LzInput[LzInPos], LzInLen - LzInPos);
+  LzInLen -= LzInPos;
+  LzInPos = 0x00;
+
+  space = LZ_INPUT_SIZE - LzInLen;
+  space -= (f_tell(&down_load_file) + space) % _MAX_SS;
+
+  if (COMMAND_ReadFile(&LzInput[LzInLen], space, &bytesread) != FR_OK)
+  {
+    return 0;
+  }
+  LzInLen += bytesread;
+
+  return (LzInLen >= needed) ? 1 : 0;
+}
+
+/**
+  * @brief  Checks the programmed image: the CRC of the flash content must
+  *         match the CRC of the data read from the file and, when present,
+  *         the CRC carried by the trailer.
+  * @param  trailer: 1 when the file carries a CRC trailer
+  * @param  crc: CRC read from the trailer
+  * @retval 0: image verified, 1: mismatch
+  */
+static uint32_t COMMAND_VerifyFlashMemory(uint8_t trailer, uint32_t crc)
+{
+  uint32_t flash_crc;
+
+  CRC_If_Reset();
+  flash_crc = CRC_If_Accumulate((const uint8_t *)ImageBase, ImageSize);
+
+  printf("crc file=%08lx flash=%08lx\n", StreamCrc, flash_crc);
+
+  if ((flash_crc != StreamCrc) || ((trailer != 0) && (crc != StreamCrc)))
+  {
+    return (1);
+  }
+
+  return (0);
+}
+
+/**
+  * @brief  MSC idle callback: programs a slice of the pending chunk while a
+  *         USB transfer is in progress.
+  * @param  phost: Host handle
+  * @retval None
+  */
+void USBH_MSC_RdWrIdleCallback(USBH_HandleTypeDef *phost)
+{
+  UNUSED(phost);
+
+  if (ProgramJob.remain != 0)
+  {
+    COMMAND_ProgramSlice(PROGRAM_SLICE_SIZE);
+  }
+}
+
+void find_bin_file(const char *name)
+{
+    FRESULT fr;     /* Return value */
+    DIR dj;         /* Directory search object */
+    FILINFO fno;    /* File information */
+
+    fr = f_findfirst(&dj, &fno, "", name);  /* Start to search for photo files */
+
+    while (fr == FR_OK && fno.fname[0]) {         /* Repeat while an item is found */
+        printf("%s\n", fno.fname);                /* Display the object name */
+        fr = f_findnext(&dj, &fno);               /* Search for next item */
+    }
+
+    f_closedir(&dj);
+}
+
 FRESULT listFiles(const TCHAR* path)
 {
   DIR dir;
@@ -0,0 +1,71 @@
+/**
+  ******************************************************************************
+  * @file    crc_if.c
+  * @brief   This file provides the hardware CRC layer functions.
+  *          The CRC unit computes the CRC-32 (polynomial 0x04C11DB7, initial
+  *          value 0xFFFFFFFF, no reflection, no final XOR) of the data taken
+  *          as little-endian 32-bit words. A trailing partial word is padded
+  *          with 0xFF, the value of erased flash.
+  ******************************************************************************
+  * @attention
+  *
+  * This software is licensed under terms that can be found in the LICENSE file
+  * in the root directory of this software component.
+  * If no LICENSE file comes with this software, it is provided AS-IS.
+  *
+  ******************************************************************************
+  */
+/* Includes ------------------------------------------------------------------ */
+#include "main.h"
+#include "crc_if.h"
+
+/* Private typedef ----------------------------------------------------------- */
+/* Private define ------------------------------------------------------------ */
+/* Private macros ------------------------------------------------------------ */
+/* Private variables --------------------------------------------------------- */
+/* Private function prototypes ----------------------------------------------- */
+/* Private functions --------------------------------------------------------- */
+
+/**
+  * @brief  Enables the CRC unit and restarts a computation.
+  * @param  None
+  * @retval None
+  */
+void CRC_If_Reset(void)
+{
+  __HAL_RCC_CRC_CLK_ENABLE();
+
+  CRC->CR = CRC_CR_RESET;
+}
+
+/**
+  * @brief  Feeds a buffer to the running CRC computation.
+  * @note   Only the last buffer of a computation may have a length which is
+  *         not a multiple of 4.
+  * @param  Data: Pointer on data buffer (RAM or memory-mapped flash)
+  * @param  Length: Number of bytes
+  * @retval CRC of all the data fed since the last CRC_If_Reset
+  */
+uint32_t CRC_If_Accumulate(const uint8_t *Data, uint32_t Length)
+{
+  uint32_t index;
+  uint32_t tail = 0xFFFFFFFF;
+
+  for (index = 0; index < (Length / 4); index++)
+  {
+    CRC->DR = ((const uint32_t *)Data)[index];
+  }
+
+  if ((Length % 4) != 0)
+  {
+    Data += Length & ~(uint32_t)3;
+    for (index = 0; index < (Length % 4); index++)
+    {
+      tail &= ~((uint32_t)0xFF << (8 * index));
+      tail |= (uint32_t)Data[index] << (8 * index);
+    }
+    CRC->DR = tail;
+  }
+
+  return CRC->DR;
+}
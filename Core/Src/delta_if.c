@@ -0,0 +1,286 @@
+/**
+  ******************************************************************************
+  * @file    delta_if.c
+  * @brief   This file applies delta files against the installed image.
+  *          The body is a list of sector records in address order. Each
+  *          rebuilt sector is built in a RAM window. When the installed
+  *          image is rebuilt in place, a sector larger than the window is
+  *          built in pieces staged in a spare sector and copied back; copies
+  *          then only read sectors not rebuilt yet. When the installed
+  *          image is in another slot, every sector is programmed in place
+  *          and the sectors without a record are copied over.
+  *          All flash and file accesses go through a DELTA_SinkTypeDef, so
+  *          the same code runs in the host tests.
+  ******************************************************************************
+  * @attention
+  *
+  * This software is licensed under terms that can be found in the LICENSE file
+  * in the root directory of this software component.
+  * If no LICENSE file comes with this software, it is provided AS-IS.
+  *
+  ******************************************************************************
+  */
+/* Includes ------------------------------------------------------------------ */
+#include <string.h>
+#include "delta_if.h"
+
+/* Private typedef ----------------------------------------------------------- */
+/* Private define ------------------------------------------------------------ */
+/* Private macros ------------------------------------------------------------ */
+#define DELTA_MIN(a, b)            (((a) < (b)) ? (a) : (b))
+
+/* Private variables --------------------------------------------------------- */
+/* Private function prototypes ----------------------------------------------- */
+static DELTA_StatusTypeDef DELTA_If_CopySource(DELTA_HandleTypeDef *hdelta, uint32_t Address, uint32_t end);
+static DELTA_StatusTypeDef DELTA_If_RebuildSector(DELTA_HandleTypeDef *hdelta, uint32_t Address,
+                                                  uint32_t length);
+static DELTA_StatusTypeDef DELTA_If_Flush(DELTA_HandleTypeDef *hdelta, uint32_t Address);
+
+/* Private functions --------------------------------------------------------- */
+
+/**
+  * @brief  Applies the body of a delta file.
+  * @note   The CRC of the resulting image is computed in address order: the
+  *         flash stands in for the sectors without a record.
+  * @param  hdelta: Delta to apply, the body read position on its first
+  *         record
+  * @param  Programmed: Receives the number of bytes rebuilt
+  * @retval DELTA_OK, or the error that stopped the update
+  */
+DELTA_StatusTypeDef DELTA_If_Apply(DELTA_HandleTypeDef *hdelta, uint32_t *Programmed)
+{
+  const DELTA_SinkTypeDef *sink = hdelta->Sink;
+  DELTA_RecordTypeDef record;
+  DELTA_StatusTypeDef status;
+  uint32_t address = hdelta->ImageBase;
+  uint32_t image_end = hdelta->ImageBase + hdelta->ImageSize;
+  uint32_t sector;
+
+  *Programmed = 0;
+
+  while (hdelta->Records > 0)
+  {
+    hdelta->Records--;
+    if (sink->Read(&record, sizeof(record)) == 0)
+    {
+      return DELTA_ERROR_READ;
+    }
+
+    /* A record rebuilds a whole sector, up to the end of the image */
+    sector = hdelta->ImageBase + record.offset;
+    hdelta->Address = sector;
+    if ((sector < address) || (sector >= image_end) ||
+        (sink->NextSector(sector - 1) != sector) ||
+        (record.length != DELTA_MIN(sink->NextSector(sector), image_end) - sector))
+    {
+      return DELTA_ERROR_FORMAT;
+    }
+
+    status = DELTA_If_CopySource(hdelta, address, sector);
+    if (status != DELTA_OK)
+    {
+      return status;
+    }
+    sink->Accumulate(sink->Map(address), sector - address);
+
+    status = DELTA_If_RebuildSector(hdelta, sector, record.length);
+    if (status != DELTA_OK)
+    {
+      return status;
+    }
+    *Programmed += record.length;
+    address = sector + record.length;
+  }
+
+  status = DELTA_If_CopySource(hdelta, address, image_end);
+  sink->Accumulate(sink->Map(address), image_end - address);
+
+  return status;
+}
+
+/**
+  * @brief  Copies sectors left unchanged by the delta from the installed
+  *         image, when it is not the one being rebuilt.
+  * @param  hdelta: Delta being applied
+  * @param  Address: Start address in the image, on a sector boundary
+  * @param  end: End address of the copy
+  * @retval DELTA_OK or DELTA_ERROR_FLASH
+  */
+static DELTA_StatusTypeDef DELTA_If_CopySource(DELTA_HandleTypeDef *hdelta, uint32_t Address, uint32_t end)
+{
+  const DELTA_SinkTypeDef *sink = hdelta->Sink;
+  uint32_t sector_end;
+
+  if (hdelta->SourceBase == hdelta->ImageBase)
+  {
+    /* Rebuilt in place: the flash already holds these sectors */
+    return DELTA_OK;
+  }
+
+  while (Address < end)
+  {
+    sector_end = DELTA_MIN(sink->NextSector(Address), end);
+    hdelta->Address = Address;
+    if ((sink->Erase(Address) != 0) ||
+        (sink->Program(Address, sink->Map(hdelta->SourceBase + Address - hdelta->ImageBase),
+                       sector_end - Address) != 0))
+    {
+      return DELTA_ERROR_FLASH;
+    }
+    Address = sector_end;
+  }
+
+  return DELTA_OK;
+}
+
+/**
+  * @brief  Rebuilds one sector from the operations of its record.
+  * @note   The content is built in the RAM window. Rebuilt in place, a
+  *         sector larger than the window is built in pieces staged in the
+  *         spare sector, then copied back: copies may only read from the
+  *         start of the sector on, so the installed image stays valid as a
+  *         source up to the erase of the sector. When the installed image
+  *         is elsewhere, the sector is erased first and the pieces are
+  *         programmed in place.
+  * @param  hdelta: Delta being applied
+  * @param  Address: Start address of the sector
+  * @param  length: Number of bytes to produce
+  * @retval DELTA_OK, or the error that stopped the rebuild
+  */
+static DELTA_StatusTypeDef DELTA_If_RebuildSector(DELTA_HandleTypeDef *hdelta, uint32_t Address,
+                                                  uint32_t length)
+{
+  const DELTA_SinkTypeDef *sink = hdelta->Sink;
+  DELTA_StatusTypeDef status;
+  uint32_t stage = hdelta->SpareAddress;
+  uint32_t staged = 0;
+  uint32_t op;
+  uint32_t size;
+  uint32_t source = 0;
+  uint32_t chunk;
+
+  if (hdelta->SourceBase != hdelta->ImageBase)
+  {
+    if (sink->Erase(Address) != 0)
+    {
+      return DELTA_ERROR_FLASH;
+    }
+    stage = Address;
+  }
+  else if (((sink->NextSector(Address) - Address) > hdelta->WindowSize) &&
+           (sink->Erase(hdelta->SpareAddress) != 0))
+  {
+    return DELTA_ERROR_FLASH;
+  }
+  hdelta->Fill = 0;
+
+  while (length > 0)
+  {
+    if (sink->Read(&op, sizeof(op)) == 0)
+    {
+      return DELTA_ERROR_READ;
+    }
+    size = op & ~DELTA_OP_COPY;
+    if (((op & DELTA_OP_COPY) != 0) && (sink->Read(&source, sizeof(source)) == 0))
+    {
+      return DELTA_ERROR_READ;
+    }
+
+    if ((size == 0) || (size > length) ||
+        (((op & DELTA_OP_COPY) != 0) &&
+         (((hdelta->SourceBase == hdelta->ImageBase) && (source < Address - hdelta->ImageBase)) ||
+          (source > hdelta->SourceSize) ||
+          (size > hdelta->SourceSize - source))))
+    {
+      return DELTA_ERROR_FORMAT;
+    }
+    length -= size;
+
+    while (size > 0)
+    {
+      if (hdelta->Fill == hdelta->WindowSize)
+      {
+        /* Window full: stage it in the spare sector or the sector itself */
+        status = DELTA_If_Flush(hdelta, stage + staged);
+        if (status != DELTA_OK)
+        {
+          return status;
+        }
+        staged += hdelta->WindowSize;
+      }
+
+      chunk = DELTA_MIN(size, hdelta->WindowSize - hdelta->Fill);
+      if ((op & DELTA_OP_COPY) != 0)
+      {
+        memcpy(&hdelta->Window[hdelta->Fill], sink->Map(hdelta->SourceBase + source), chunk);
+        source += chunk;
+      }
+      else if (sink->Read(&hdelta->Window[hdelta->Fill], chunk) == 0)
+      {
+        return DELTA_ERROR_READ;
+      }
+      hdelta->Fill += chunk;
+      size -= chunk;
+    }
+  }
+
+  if (stage == Address)
+  {
+    return DELTA_If_Flush(hdelta, Address + staged);
+  }
+
+  if (staged == 0)
+  {
+    /* The whole sector is in RAM */
+    if (sink->Erase(Address) != 0)
+    {
+      return DELTA_ERROR_FLASH;
+    }
+    return DELTA_If_Flush(hdelta, Address);
+  }
+
+  staged += hdelta->Fill;
+  status = DELTA_If_Flush(hdelta, hdelta->SpareAddress + staged - hdelta->Fill);
+  if (status != DELTA_OK)
+  {
+    return status;
+  }
+
+  if ((sink->Erase(Address) != 0) ||
+      (sink->Program(Address, sink->Map(hdelta->SpareAddress), staged) != 0))
+  {
+    return DELTA_ERROR_FLASH;
+  }
+
+  return DELTA_OK;
+}
+
+/**
+  * @brief  Programs the content of the RAM window and empties it.
+  * @note   The data is added to the image CRC on the way: the window pieces
+  *         are programmed in address order.
+  * @param  hdelta: Delta being applied
+  * @param  Address: Flash address of the first byte, erased
+  * @retval DELTA_OK or DELTA_ERROR_FLASH
+  */
+static DELTA_StatusTypeDef DELTA_If_Flush(DELTA_HandleTypeDef *hdelta, uint32_t Address)
+{
+  const DELTA_SinkTypeDef *sink = hdelta->Sink;
+  uint32_t fill = hdelta->Fill;
+
+  sink->Accumulate(hdelta->Window, fill);
+
+  /* Pad the last program unit with the erased value */
+  if ((fill % hdelta->ProgramUnit) != 0)
+  {
+    memset(&hdelta->Window[fill], 0xFF, hdelta->ProgramUnit - (fill % hdelta->ProgramUnit));
+  }
+
+  hdelta->Fill = 0;
+  if (sink->Program(Address, hdelta->Window, fill) != 0)
+  {
+    return DELTA_ERROR_FLASH;
+  }
+
+  return DELTA_OK;
+}
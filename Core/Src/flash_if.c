@@ -21,6 +21,12 @@
 
 /* Private typedef ----------------------------------------------------------- */
 /* Private define ------------------------------------------------------------ */
+#define FLASH_IF_TIMEOUT_VALUE     50000U /* 50 s */
+
+/* Status flags reporting a failed program operation */
+#define FLASH_IF_ERROR_FLAGS       (FLASH_FLAG_OPERR | FLASH_FLAG_WRPERR | FLASH_FLAG_PGAERR | \
+                                    FLASH_FLAG_PGPERR | FLASH_FLAG_PGSERR)
+
 /* Private macros ------------------------------------------------------------ */
 /* Private variables --------------------------------------------------------- */
 uint32_t FirstSector = 0;
@@ -28,10 +34,24 @@ uint32_t NbOfSectors = 0;
 uint32_t SectorError = 0;
 uint32_t OB_RDP_LEVEL;
 
+extern FLASH_ProcessTypeDef pFlash;
+
+/* Base address of each sector, followed by the end of the Bank 1 */
+static const uint32_t FLASH_If_SectorAddress[] =
+{
+  ADDR_FLASH_SECTOR_0, ADDR_FLASH_SECTOR_1, ADDR_FLASH_SECTOR_2,
+  ADDR_FLASH_SECTOR_3, ADDR_FLASH_SECTOR_4, ADDR_FLASH_SECTOR_5,
+  ADDR_FLASH_SECTOR_6, ADDR_FLASH_SECTOR_7, ADDR_FLASH_SECTOR_8,
+  ADDR_FLASH_SECTOR_9, ADDR_FLASH_SECTOR_10, ADDR_FLASH_SECTOR_11,
+  ADDR_FLASH_SECTOR_12
+};
+
 /* Private function prototypes ----------------------------------------------- */
-static uint32_t FLASH_If_GetSectorNumber(uint32_t Address);
 static FLASH_OBProgramInitTypeDef FLASH_OBProgramInitStruct;
 static FLASH_EraseInitTypeDef FLASH_EraseInitStruct;
+#if (DUAL_SLOT == 1)
+static uint32_t FLASH_If_GetSelectorLog(void);
+#endif
 
 /* Private functions --------------------------------------------------------- */
 
@@ -92,7 +112,7 @@ uint32_t FLASH_If_EraseSectors(uint32_t Address)
     FLASH_EraseInitStruct.TypeErase = FLASH_TYPEERASE_SECTORS;
     FLASH_EraseInitStruct.Sector = FirstSector;
     FLASH_EraseInitStruct.NbSectors = NbOfSectors;
-    FLASH_EraseInitStruct.VoltageRange = FLASH_VOLTAGE_RANGE_3;
+    FLASH_EraseInitStruct.VoltageRange = FLASH_IF_VOLTAGE_RANGE;
 
     if (HAL_FLASHEx_Erase(&FLASH_EraseInitStruct, &SectorError) != HAL_OK)
       return (1);
@@ -106,21 +126,21 @@ uint32_t FLASH_If_EraseSectors(uint32_t Address)
 }
 
 /**
-  * @brief  Writes a data buffer in flash (data are 32-bit aligned).
-  * @note   After writing data buffer, the flash content is checked.
-  * @param  Address: Start address for writing data buffer
-  * @param  Data: Pointer on data buffer
-  * @retval 0: Data successfully written to Flash memory
-  *         1: Error occurred while writing data in Flash memory
+  * @brief  Erases the single FLASH Sector containing an address.
+  * @param  Address: Any address inside the sector to erase
+  * @retval 0: Erase sector done with success
+  *         1: Erase error
   */
-uint32_t FLASH_If_Write(uint32_t Address, uint32_t Data)
+uint32_t FLASH_If_EraseSector(uint32_t Address)
 {
-  /* Program the user Flash area word by word (area defined by
-   * FLASH_USER_START_ADDR and APPLICATION_ADDRESS) ********** */
-
   if (Address <= (uint32_t) USER_FLASH_LAST_PAGE_ADDRESS)
   {
-    if (HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, Address, Data) != HAL_OK)
+    FLASH_EraseInitStruct.TypeErase = FLASH_TYPEERASE_SECTORS;
+    FLASH_EraseInitStruct.Sector = FLASH_If_GetSectorNumber(Address);
+    FLASH_EraseInitStruct.NbSectors = 1;
+    FLASH_EraseInitStruct.VoltageRange = FLASH_IF_VOLTAGE_RANGE;
+
+    if (HAL_FLASHEx_Erase(&FLASH_EraseInitStruct, &SectorError) != HAL_OK)
       return (1);
   }
   else
@@ -131,12 +151,269 @@ uint32_t FLASH_If_Write(uint32_t Address, uint32_t Data)
   return (0);
 }
 
+/**
+  * @brief  Writes a word in flash with the parallelism selected by
+  *         FLASH_IF_VOLTAGE_RANGE.
+  * @note   With the x64 parallelism the word is followed by the erased
+  *         value to fill the program unit.
+  * @param  Address: Address of the word, aligned on FLASH_IF_PROGRAM_UNIT
+  *         when the unit is larger than a word
+  * @param  Data: Word to write
+  * @retval 0: Data successfully written to Flash memory
+  *         1: Error occurred while writing data in Flash memory
+  */
+uint32_t FLASH_If_Write(uint32_t Address, uint32_t Data)
+{
+  uint32_t unit[2] = { Data, 0xFFFFFFFF };
+
+  return FLASH_If_WriteBuffer(Address, (const uint8_t *)unit, sizeof(Data));
+}
+
+/**
+  * @brief  Writes a data buffer in flash with the parallelism selected by
+  *         FLASH_IF_VOLTAGE_RANGE.
+  * @note   The PG bit stays set for the whole buffer and only the BSY flag is
+  *         polled between program operations, so there is no per-word HAL
+  *         locking or tick reading. The length is rounded up to a whole
+  *         number of FLASH_IF_PROGRAM_UNIT.
+  * @param  Address: Start address for writing data buffer, aligned on
+  *         FLASH_IF_PROGRAM_UNIT
+  * @param  Data: Pointer on data buffer (32-bit aligned)
+  * @param  Length: Number of bytes to write
+  * @retval 0: Data successfully written to Flash memory
+  *         1: Error occurred while writing data in Flash memory
+  */
+uint32_t FLASH_If_WriteBuffer(uint32_t Address, const uint8_t *Data, uint32_t Length)
+{
+  uint32_t end = Address + Length;
+  uint32_t status = 0;
+
+  if ((Length == 0) ||
+      ((end - 1) > (uint32_t) USER_FLASH_LAST_PAGE_ADDRESS + FLASH_IF_PROGRAM_UNIT - 1))
+  {
+    return (Length == 0) ? 0 : 1;
+  }
+
+  /* Process Locked */
+  __HAL_LOCK(&pFlash);
+
+  if (FLASH_WaitForLastOperation(FLASH_IF_TIMEOUT_VALUE) != HAL_OK)
+  {
+    __HAL_UNLOCK(&pFlash);
+    return (1);
+  }
+
+  CLEAR_BIT(FLASH->CR, FLASH_CR_PSIZE);
+  FLASH->CR |= (FLASH_IF_VOLTAGE_RANGE << FLASH_CR_PSIZE_Pos);
+  FLASH->CR |= FLASH_CR_PG;
+
+  while ((Address < end) && (status == 0))
+  {
+#if (FLASH_IF_VOLTAGE_RANGE == FLASH_VOLTAGE_RANGE_4)
+    *(__IO uint32_t *)Address = *(const uint32_t *)Data;
+    /* The two halves of a double word must reach the flash in order */
+    __ISB();
+    *(__IO uint32_t *)(Address + 4) = *(const uint32_t *)(Data + 4);
+#elif (FLASH_IF_VOLTAGE_RANGE == FLASH_VOLTAGE_RANGE_3)
+    *(__IO uint32_t *)Address = *(const uint32_t *)Data;
+#elif (FLASH_IF_VOLTAGE_RANGE == FLASH_VOLTAGE_RANGE_2)
+    *(__IO uint16_t *)Address = *(const uint16_t *)Data;
+#else
+    *(__IO uint8_t *)Address = *Data;
+#endif
+    Address += FLASH_IF_PROGRAM_UNIT;
+    Data += FLASH_IF_PROGRAM_UNIT;
+
+    while ((FLASH->SR & FLASH_SR_BSY) != 0U)
+    {
+    }
+
+    if ((FLASH->SR & FLASH_IF_ERROR_FLAGS) != 0U)
+    {
+      status = 1;
+    }
+  }
+
+  /* Disable the PG Bit and clear the status flags */
+  FLASH->CR &= (~FLASH_CR_PG);
+  __HAL_FLASH_CLEAR_FLAG(FLASH_FLAG_EOP | FLASH_IF_ERROR_FLAGS);
+
+  /* Process Unlocked */
+  __HAL_UNLOCK(&pFlash);
+
+  return status;
+}
+
+/**
+  * @brief  Returns the base address of the sector following an address
+  * @param  Address: Any address inside the current sector
+  * @retval Base address of the next sector
+  */
+uint32_t FLASH_If_GetNextSectorAddress(uint32_t Address)
+{
+  return FLASH_If_SectorAddress[FLASH_If_GetSectorNumber(Address) + 1];
+}
+
+/**
+  * @brief  Finds the end of the programmed data in a flash area.
+  * @note   The area is scanned backwards; erased blocks of four words are
+  *         skipped with a single all-ones check.
+  * @param  Address: Start address of the area (32-bit aligned)
+  * @param  Length: Size of the area in bytes
+  * @retval Address following the last non-erased word, Address if the whole
+  *         area is erased
+  */
+uint32_t FLASH_If_GetProgrammedEnd(uint32_t Address, uint32_t Length)
+{
+  const uint32_t *word = (const uint32_t *)(Address + (Length & ~(uint32_t)3));
+
+  while (((uint32_t)word - Address) >= 16)
+  {
+    if ((word[-1] & word[-2] & word[-3] & word[-4]) != 0xFFFFFFFF)
+    {
+      break;
+    }
+    word -= 4;
+  }
+
+  while (((uint32_t)word > Address) && (word[-1] == 0xFFFFFFFF))
+  {
+    word--;
+  }
+
+  return (uint32_t)word;
+}
+
+/**
+  * @brief  Returns the address of the application to boot.
+  * @note   With DUAL_SLOT the boot selector log in use is read backwards
+  *         from its last programmed word: a word left partly programmed by
+  *         a power loss is not a valid tag and is passed over.
+  * @param  None
+  * @retval APPLICATION_ADDRESS, or the base address of the selected slot
+  */
+uint32_t FLASH_If_GetBootAddress(void)
+{
+#if (DUAL_SLOT == 1)
+  uint32_t log = FLASH_If_GetSelectorLog();
+  const uint32_t *word;
+
+  if (log == 0)
+  {
+    return SLOT_A_ADDRESS;
+  }
+
+  word = (const uint32_t *)FLASH_If_GetProgrammedEnd(log, SLOT_SELECTOR_SIZE);
+  while ((uint32_t)word > log + SLOT_SELECTOR_HEADER_SIZE)
+  {
+    word--;
+    if (*word == SLOT_TAG_B)
+    {
+      return SLOT_B_ADDRESS;
+    }
+    if (*word == SLOT_TAG_A)
+    {
+      break;
+    }
+  }
+
+  return SLOT_A_ADDRESS;
+#else
+  return APPLICATION_ADDRESS;
+#endif
+}
+
+/**
+  * @brief  Returns the address a new image is programmed at.
+  * @param  None
+  * @retval APPLICATION_ADDRESS, or the base address of the slot not booted
+  */
+uint32_t FLASH_If_GetUpdateAddress(void)
+{
+#if (DUAL_SLOT == 1)
+  return (FLASH_If_GetBootAddress() == SLOT_A_ADDRESS) ? SLOT_B_ADDRESS : SLOT_A_ADDRESS;
+#else
+  return APPLICATION_ADDRESS;
+#endif
+}
+
+#if (DUAL_SLOT == 1)
+/**
+  * @brief  Selects the slot booted from now on.
+  * @note   The switch is the program operation of a single word: a power
+  *         loss leaves either the previous tag or the new one in effect.
+  *         When the log is full, the other log is erased and gets the tag,
+  *         then its header: up to that last program operation the full log
+  *         stays in use, so a power loss never loses the selection.
+  * @param  Address: Base address of the slot
+  * @retval 0: slot selected, 1: flash error
+  */
+uint32_t FLASH_If_SelectSlot(uint32_t Address)
+{
+  uint32_t tag = (Address == SLOT_B_ADDRESS) ? SLOT_TAG_B : SLOT_TAG_A;
+  uint32_t header[2] = { 1, 0 };
+  uint32_t log;
+  uint32_t end;
+
+  if (FLASH_If_GetBootAddress() == Address)
+  {
+    return (0);
+  }
+
+  log = FLASH_If_GetSelectorLog();
+  if (log != 0)
+  {
+    /* Each tag starts a program unit */
+    end = FLASH_If_GetProgrammedEnd(log, SLOT_SELECTOR_SIZE);
+    end = (end + FLASH_IF_PROGRAM_UNIT - 1) & ~(FLASH_IF_PROGRAM_UNIT - 1);
+    if (end < log + SLOT_SELECTOR_SIZE)
+    {
+      return FLASH_If_Write(end, tag);
+    }
+    header[0] = *(const uint32_t *)log + 1;
+  }
+
+  /* No room left: go on in the other log */
+  log = (log == SLOT_SELECTOR_ADDRESS) ? SLOT_SELECTOR_ALT_ADDRESS : SLOT_SELECTOR_ADDRESS;
+  header[1] = ~header[0];
+  if ((FLASH_If_EraseSector(log) != 0) ||
+      (FLASH_If_Write(log + SLOT_SELECTOR_HEADER_SIZE, tag) != 0))
+  {
+    return (1);
+  }
+
+  return FLASH_If_WriteBuffer(log, (const uint8_t *)header, sizeof(header));
+}
+
+/**
+  * @brief  Returns the boot selector log in use.
+  * @note   A log is valid once its header holds a generation number and its
+  *         complement; of two valid logs the later generation wins.
+  * @param  None
+  * @retval Address of the log, 0 when neither log is valid
+  */
+static uint32_t FLASH_If_GetSelectorLog(void)
+{
+  const uint32_t *log = (const uint32_t *)SLOT_SELECTOR_ADDRESS;
+  const uint32_t *alt = (const uint32_t *)SLOT_SELECTOR_ALT_ADDRESS;
+  uint8_t log_valid = (log[1] == ~log[0]) ? 1 : 0;
+  uint8_t alt_valid = (alt[1] == ~alt[0]) ? 1 : 0;
+
+  if ((alt_valid != 0) && ((log_valid == 0) || ((int32_t)(alt[0] - log[0]) > 0)))
+  {
+    return SLOT_SELECTOR_ALT_ADDRESS;
+  }
+
+  return (log_valid != 0) ? SLOT_SELECTOR_ADDRESS : 0;
+}
+#endif /* DUAL_SLOT == 1 */
+
 /**
   * @brief  Returns the Flash sector Number of the address
   * @param  None
   * @retval The Flash sector Number of the address
   */
-static uint32_t FLASH_If_GetSectorNumber(uint32_t Address)
+uint32_t FLASH_If_GetSectorNumber(uint32_t Address)
 {
   uint32_t sector = 0;
 
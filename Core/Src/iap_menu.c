@@ -21,6 +21,7 @@
 #include "usb_host.h"
 #include "flash_if.h"
 #include "command.h"
+#include "trace_if.h"
 
 /* Private typedef ----------------------------------------------------------- */
 /* Private define ------------------------------------------------------------ */
@@ -28,6 +29,11 @@
 #define INIT_STATE    ((uint8_t)0x00)
 #define IAP_STATE     ((uint8_t)0x01)
 
+/* Longest wait for a device before booting the application, in ms */
+#ifndef NO_DEVICE_TIMEOUT
+#define NO_DEVICE_TIMEOUT   4000U
+#endif
+
 /* Private macro ------------------------------------------------------------- */
 /* Private variables --------------------------------------------------------- */
 __IO uint32_t UploadCondition = 0x00;
@@ -61,6 +67,7 @@ void FW_UPGRADE_Process(void)
       FatFs_Fail_Handler();
     }
     // printf("mount ok\n");
+    TRACE_POINT(TRACE_MOUNT, 0);
 
     /* Go to IAP menu */
     g_state = IAP_STATE;
@@ -108,11 +115,14 @@ void FW_UPGRADE_Process(void)
         FLASH_EraseInitStruct.TypeErase = FLASH_TYPEERASE_SECTORS;
         FLASH_EraseInitStruct.Sector = FLASH_SECTOR_2;
         FLASH_EraseInitStruct.NbSectors = 1;
-        FLASH_EraseInitStruct.VoltageRange = FLASH_VOLTAGE_RANGE_3;
+        FLASH_EraseInitStruct.VoltageRange = FLASH_IF_VOLTAGE_RANGE;
 
         if (HAL_FLASHEx_Erase(&FLASH_EraseInitStruct, &SectorError) != HAL_OK) {
 
         }
+
+        /* The record of the installed image lives in the same sector */
+        COMMAND_SaveImageRecord();
         
         COMMAND_Jump();
       }
@@ -125,7 +135,10 @@ void FW_UPGRADE_Process(void)
 
   if (Appli_state == APPLICATION_IDLE) {
     // printf("state: %d, %lu\n", Appli_state, HAL_GetTick());
-    if (HAL_GetTick() > 4000) {
+    /* Boot as soon as the port is known to be empty, the fixed timeout only
+     * bounds an attachment that never completes */
+    if (USBH_LL_IsPortEmpty() || (HAL_GetTick() > NO_DEVICE_TIMEOUT)) {
+      TRACE_POINT(TRACE_IDLE_TIMEOUT, HAL_GetTick());
       jump2app();
     }
   }
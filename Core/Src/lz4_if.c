@@ -0,0 +1,142 @@
+/**
+  ******************************************************************************
+  * @file    lz4_if.c
+  * @brief   This file provides the LZ4 block decoder.
+  *          A block is a list of sequences: a token (literal length in the
+  *          high nibble, match length minus 4 in the low nibble), the
+  *          literals, a 16-bit little-endian match offset and the match.
+  *          A nibble of 15 is extended by the following bytes up to a byte
+  *          other than 255. The last sequence stops after its literals.
+  *          Blocks are independent: no history is kept between them.
+  ******************************************************************************
+  * @attention
+  *
+  * This software is licensed under terms that can be found in the LICENSE file
+  * in the root directory of this software component.
+  * If no LICENSE file comes with this software, it is provided AS-IS.
+  *
+  ******************************************************************************
+  */
+/* Includes ------------------------------------------------------------------ */
+#include <string.h>
+#include "lz4_if.h"
+
+/* Private typedef ----------------------------------------------------------- */
+/* Private define ------------------------------------------------------------ */
+#define LZ4_MIN_MATCH              4U
+
+/* Private macros ------------------------------------------------------------ */
+/* Private variables --------------------------------------------------------- */
+/* Private function prototypes ----------------------------------------------- */
+static uint8_t LZ4_If_ReadLength(const uint8_t **src, const uint8_t *end, uint32_t *length);
+
+/* Private functions --------------------------------------------------------- */
+
+/**
+  * @brief  Decodes one LZ4 block.
+  * @note   Every length and offset is checked against the buffers: a corrupt
+  *         block is reported, never written out of bounds.
+  * @param  Src: Compressed data
+  * @param  SrcLength: Number of compressed bytes
+  * @param  Dst: Destination buffer
+  * @param  DstLength: Size of the destination buffer
+  * @retval Number of bytes decoded, 0 on a corrupt block
+  */
+uint32_t LZ4_If_DecodeBlock(const uint8_t *Src, uint32_t SrcLength, uint8_t *Dst, uint32_t DstLength)
+{
+  const uint8_t *src_end = Src + SrcLength;
+  uint8_t *dst = Dst;
+  uint8_t *dst_end = Dst + DstLength;
+  const uint8_t *match;
+  uint32_t length;
+  uint32_t offset;
+  uint8_t token;
+
+  while (Src < src_end)
+  {
+    token = *Src++;
+
+    /* Literals */
+    length = token >> 4;
+    if ((LZ4_If_ReadLength(&Src, src_end, &length) == 0) ||
+        (length > (uint32_t)(src_end - Src)) || (length > (uint32_t)(dst_end - dst)))
+    {
+      return 0;
+    }
+    memcpy(dst, Src, length);
+    Src += length;
+    dst += length;
+
+    if (Src == src_end)
+    {
+      /* Last sequence: no match part */
+      break;
+    }
+
+    /* Match */
+    if ((src_end - Src) < 2)
+    {
+      return 0;
+    }
+    offset = Src[0] | ((uint32_t)Src[1] << 8);
+    Src += 2;
+
+    length = token & 0x0F;
+    if ((LZ4_If_ReadLength(&Src, src_end, &length) == 0) ||
+        (offset == 0) || (offset > (uint32_t)(dst - Dst)))
+    {
+      return 0;
+    }
+    length += LZ4_MIN_MATCH;
+    if (length > (uint32_t)(dst_end - dst))
+    {
+      return 0;
+    }
+
+    match = dst - offset;
+    if (offset >= length)
+    {
+      memcpy(dst, match, length);
+      dst += length;
+    }
+    else
+    {
+      /* Overlapping copy: repeats the last offset bytes */
+      while (length-- > 0)
+      {
+        *dst++ = *match++;
+      }
+    }
+  }
+
+  return (uint32_t)(dst - Dst);
+}
+
+/**
+  * @brief  Adds the extension bytes of a length field.
+  * @param  src: Read pointer, moved past the extension bytes
+  * @param  end: End of the compressed data
+  * @param  length: Nibble value on entry, full length on return
+  * @retval 1: length read, 0: data ends within the length field
+  */
+static uint8_t LZ4_If_ReadLength(const uint8_t **src, const uint8_t *end, uint32_t *length)
+{
+  uint8_t byte;
+
+  if (*length != 15)
+  {
+    return 1;
+  }
+
+  do
+  {
+    if (*src >= end)
+    {
+      return 0;
+    }
+    byte = *(*src)++;
+    *length += byte;
+  } while (byte == 255);
+
+  return 1;
+}
@@ -26,6 +26,8 @@
 /* Private includes ----------------------------------------------------------*/
 /* USER CODE BEGIN Includes */
 #include "flash_if.h"
+#include "trace_if.h"
+#include "command.h"
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -35,6 +37,12 @@
 
 /* Private define ------------------------------------------------------------*/
 /* USER CODE BEGIN PD */
+/* Clock profile of the update path:
+   1: SYSCLK from the PLL at 168 MHz (APB1 42 MHz, APB2 84 MHz, USB 48 MHz)
+   0: SYSCLK from the 16 MHz HSI as configured by SystemClock_Config */
+#ifndef HIGH_PERFORMANCE_CLOCK
+#define HIGH_PERFORMANCE_CLOCK    1
+#endif
 /* USER CODE END PD */
 
 /* Private macro -------------------------------------------------------------*/
@@ -55,6 +63,8 @@ void MX_USB_HOST_Process(void);
 /* USER CODE BEGIN PFP */
 void jump2app(void);
 void FW_UPGRADE_Process(void);
+static void SystemClock_HighPerformance_Config(void);
+static void SystemClock_Restore(void);
 /* USER CODE END PFP */
 
 /* Private user code ---------------------------------------------------------*/
@@ -69,6 +79,7 @@ void FW_UPGRADE_Process(void);
 int main(void)
 {
   /* USER CODE BEGIN 1 */
+  TRACE_If_Init();
   MX_GPIO_Init();
   MX_USART2_UART_Init();
   /* USER CODE END 1 */
@@ -86,7 +97,13 @@ int main(void)
   SystemClock_Config();
 
   /* USER CODE BEGIN SysInit */
+#if (HIGH_PERFORMANCE_CLOCK == 1)
+  SystemClock_HighPerformance_Config();
 
+  /* USART2 was set up before the clock switch: recompute its baud rate */
+  MX_USART2_UART_Init();
+#endif
+  TRACE_POINT(TRACE_CLOCK_READY, SystemCoreClock / 1000000U);
   /* USER CODE END SysInit */
 
   /* Initialize all configured peripherals */
@@ -95,6 +112,8 @@ int main(void)
   MX_FATFS_Init();
   MX_USB_HOST_Init();
   /* USER CODE BEGIN 2 */
+  TRACE_POINT(TRACE_USB_INIT, 0);
+
   /* Test if USER button is pressed */
   if (HAL_GPIO_ReadPin(LEFT_SW_GPIO_Port, LEFT_SW_Pin) != GPIO_PIN_RESET && *(uint32_t *)0x0800BFFC != 0x5A5A5A5A) {
     /* Check Vector Table: Test if user code is programmed starting from
@@ -119,6 +138,13 @@ int main(void)
 
     /* USER CODE BEGIN 3 */
 
+    /* Hash the installed image while the stick enumerates */
+    if (COMMAND_PrecomputeInstalledCrc() == 0)
+    {
+      /* Nothing left to hash: sleep until a USB event or the next tick */
+      MX_USB_HOST_Idle();
+    }
+
     FW_UPGRADE_Process();
   }
   /* USER CODE END 3 */
@@ -171,21 +197,85 @@ void SystemClock_Config(void)
 }
 
 /* USER CODE BEGIN 4 */
+/**
+  * @brief Switches SYSCLK to the PLL at 168 MHz, keeping the 48 MHz USB clock
+  * @note  The PLL keeps the HSI source so the USB clock is unchanged. The ART
+  *        accelerator (prefetch, instruction and data caches) is already
+  *        enabled by HAL_Init.
+  * @retval None
+  */
+static void SystemClock_HighPerformance_Config(void)
+{
+  RCC_OscInitTypeDef RCC_OscInitStruct = {0};
+  RCC_ClkInitTypeDef RCC_ClkInitStruct = {0};
+
+  /** VCO = 16 MHz / 16 * 336 = 336 MHz, SYSCLK = 336 / 2 = 168 MHz,
+  * USB = 336 / 7 = 48 MHz
+  */
+  RCC_OscInitStruct.OscillatorType = RCC_OSCILLATORTYPE_NONE;
+  RCC_OscInitStruct.PLL.PLLState = RCC_PLL_ON;
+  RCC_OscInitStruct.PLL.PLLSource = RCC_PLLSOURCE_HSI;
+  RCC_OscInitStruct.PLL.PLLM = 16;
+  RCC_OscInitStruct.PLL.PLLN = 336;
+  RCC_OscInitStruct.PLL.PLLP = RCC_PLLP_DIV2;
+  RCC_OscInitStruct.PLL.PLLQ = 7;
+  if (HAL_RCC_OscConfig(&RCC_OscInitStruct) != HAL_OK)
+  {
+    Error_Handler();
+  }
+
+  /** 5 wait states at 168 MHz and 2.7 V to 3.6 V
+  */
+  RCC_ClkInitStruct.ClockType = RCC_CLOCKTYPE_HCLK|RCC_CLOCKTYPE_SYSCLK
+                              |RCC_CLOCKTYPE_PCLK1|RCC_CLOCKTYPE_PCLK2;
+  RCC_ClkInitStruct.SYSCLKSource = RCC_SYSCLKSOURCE_PLLCLK;
+  RCC_ClkInitStruct.AHBCLKDivider = RCC_SYSCLK_DIV1;
+  RCC_ClkInitStruct.APB1CLKDivider = RCC_HCLK_DIV4;
+  RCC_ClkInitStruct.APB2CLKDivider = RCC_HCLK_DIV2;
+
+  if (HAL_RCC_ClockConfig(&RCC_ClkInitStruct, FLASH_LATENCY_5) != HAL_OK)
+  {
+    Error_Handler();
+  }
+}
+
+/**
+  * @brief Puts the clock tree back to its reset state before the application
+  *        is started: HSI as SYSCLK, PLL off, no prescaler, 0 wait state
+  * @retval None
+  */
+static void SystemClock_Restore(void)
+{
+  HAL_RCC_DeInit();
+  __HAL_FLASH_SET_LATENCY(FLASH_LATENCY_0);
+}
+
 uint32_t jump_addr;
 fun_t jump_fun;
 
 void jump2app(void)
 {
-  if ((((*(__IO uint32_t *) APPLICATION_ADDRESS) & 0xFF000000) == 0x20000000) || (((*(__IO uint32_t *) APPLICATION_ADDRESS) & 0xFF000000) == 0x10000000)) {
+  /* APPLICATION_ADDRESS, or the selected slot with DUAL_SLOT */
+  uint32_t app_addr = FLASH_If_GetBootAddress();
+
+  if ((((*(__IO uint32_t *) app_addr) & 0xFF000000) == 0x20000000) || (((*(__IO uint32_t *) app_addr) & 0xFF000000) == 0x10000000)) {
+    printf("jump 2 app\n");
+    TRACE_POINT(TRACE_JUMP, 0);
+#if (BOOT_TRACE == 1) && (TRACE_IF_DUMP_ON_JUMP == 1)
+    TRACE_If_Dump();
+#endif
+
+    /* The application expects the reset clock configuration */
+    SystemClock_Restore();
+
     /* Jump to user application */
-    jump_addr = *(__IO uint32_t *) (APPLICATION_ADDRESS + 4);
+    jump_addr = *(__IO uint32_t *) (app_addr + 4);
     jump_fun = (fun_t) jump_addr;
     /* Initialize user application's Stack Pointer */
-    __set_MSP(*(__IO uint32_t *) APPLICATION_ADDRESS);
+    __set_MSP(*(__IO uint32_t *) app_addr);
     __disable_irq();
     NVIC_DisableIRQ(OTG_FS_IRQn);
 
-    printf("jump 2 app\n");
     jump_fun();
   } else {
     Fail_Handler();
@@ -0,0 +1,141 @@
+/**
+  ******************************************************************************
+  * @file    trace_if.c
+  * @brief   This file provides the boot timeline functions.
+  *          Phase events are timestamped with the DWT cycle counter and kept
+  *          in a RAM ring buffer. The timestamps are converted to
+  *          microseconds when recorded, with the core clock of the moment,
+  *          so the timeline stays right across the clock switches.
+  *          An event costs a few tens of cycles and no peripheral access
+  *          other than the DWT: the recording may stay in production builds.
+  ******************************************************************************
+  * @attention
+  *
+  * This software is licensed under terms that can be found in the LICENSE file
+  * in the root directory of this software component.
+  * If no LICENSE file comes with this software, it is provided AS-IS.
+  *
+  ******************************************************************************
+  */
+/* Includes ------------------------------------------------------------------ */
+#include "main.h"
+#include "trace_if.h"
+#include <stdio.h>
+
+/* Private typedef ----------------------------------------------------------- */
+typedef struct
+{
+  uint32_t time;                        /* Microseconds since TRACE_If_Init */
+  uint16_t event;                       /* TRACE_EventTypeDef */
+  uint16_t arg;                         /* Event specific value */
+} TRACE_EntryTypeDef;
+
+/* Private define ------------------------------------------------------------ */
+/* Private macros ------------------------------------------------------------ */
+/* Private variables --------------------------------------------------------- */
+static TRACE_EntryTypeDef TraceBuf[TRACE_IF_DEPTH];
+/* Number of events recorded, the ring holds the last TRACE_IF_DEPTH ones */
+static uint32_t TraceCount = 0x00;
+/* Time base: cycle counter value at the last event, cycles not yet
+   converted and core cycles per microsecond */
+static uint32_t TraceLastCycles = 0x00;
+static uint32_t TraceRemainder = 0x00;
+static uint32_t TraceCyclesPerUs = 16;
+static uint32_t TraceTime = 0x00;
+
+static const char * const TraceName[TRACE_EVENT_COUNT] =
+{
+  "reset", "clock", "usb init", "attach", "port reset", "port enabled",
+  "connect", "class active", "disconnect",
+  "mount", "find file", "erase", "program", "verify", "idle timeout", "jump"
+};
+
+/* Private function prototypes ----------------------------------------------- */
+/* Private functions --------------------------------------------------------- */
+
+/**
+  * @brief  Starts the cycle counter and clears the timeline.
+  * @note   To be called first thing in main(): the time spent in the startup
+  *         code before it is not accounted.
+  * @param  None
+  * @retval None
+  */
+void TRACE_If_Init(void)
+{
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+  DWT->CYCCNT = 0;
+  DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+  TraceCount = 0x00;
+  TraceLastCycles = 0x00;
+  TraceRemainder = 0x00;
+  TraceTime = 0x00;
+  TraceCyclesPerUs = SystemCoreClock / 1000000U;
+
+  TRACE_If_Record(TRACE_RESET, 0);
+}
+
+/**
+  * @brief  Appends an event to the timeline.
+  * @note   Callable from the main loop and from interrupt handlers (the
+  *         USB attach and port enabled events come from the OTG_FS ISR):
+  *         the timeline is updated with interrupts masked. Two events must
+  *         be less than one counter period apart (25 s at 168 MHz).
+  * @param  Event: Phase reached
+  * @param  Arg: Event specific value, truncated to 16 bits
+  * @retval None
+  */
+void TRACE_If_Record(TRACE_EventTypeDef Event, uint32_t Arg)
+{
+  uint32_t primask = __get_PRIMASK();
+  uint32_t now;
+  uint32_t elapsed;
+  TRACE_EntryTypeDef *entry;
+
+  __disable_irq();
+  now = DWT->CYCCNT;
+  elapsed = now - TraceLastCycles + TraceRemainder;
+
+  /* Cycles since the last event ran at the clock known at that event */
+  TraceTime += elapsed / TraceCyclesPerUs;
+  TraceRemainder = elapsed % TraceCyclesPerUs;
+  TraceLastCycles = now;
+  TraceCyclesPerUs = SystemCoreClock / 1000000U;
+
+  entry = &TraceBuf[TraceCount & (TRACE_IF_DEPTH - 1U)];
+  entry->time = TraceTime;
+  entry->event = (uint16_t)Event;
+  entry->arg = (uint16_t)Arg;
+  TraceCount++;
+
+  __set_PRIMASK(primask);
+}
+
+/**
+  * @brief  Prints the timeline on the console (USART2).
+  * @note   Each line gives the time of the event and the time elapsed since
+  *         the previous one, both in microseconds.
+  * @param  None
+  * @retval None
+  */
+void TRACE_If_Dump(void)
+{
+  uint32_t index = 0x00;
+  uint32_t previous;
+  TRACE_EntryTypeDef *entry;
+
+  if (TraceCount > TRACE_IF_DEPTH)
+  {
+    index = TraceCount - TRACE_IF_DEPTH;
+    printf("trace: %lu oldest events lost\n", index);
+  }
+  previous = TraceBuf[index & (TRACE_IF_DEPTH - 1U)].time;
+
+  for (; index < TraceCount; index++)
+  {
+    entry = &TraceBuf[index & (TRACE_IF_DEPTH - 1U)];
+    printf("trace %10lu us +%9lu us %-12s %u\n", entry->time, entry->time - previous,
+           (entry->event < TRACE_EVENT_COUNT) ? TraceName[entry->event] : "?", entry->arg);
+    previous = entry->time;
+  }
+}
@@ -199,6 +199,10 @@ typedef struct
 
   uint32_t  xfer_count;         /*!< Partial transfer length in case of multi packet transfer.                  */
 
+  uint8_t   *urb_buff;          /*!< Start of the buffer of the submitted URB.                                  */
+
+  uint32_t  urb_len;            /*!< Length of the submitted URB.                                               */
+
   uint8_t   toggle_in;          /*!< IN transfer current toggle flag.
                                      This parameter must be a number between Min_Data = 0 and Max_Data = 1      */
 
@@ -494,6 +498,7 @@ void              USB_ClearInterrupts(USB_OTG_GlobalTypeDef *USBx, uint32_t inte
 HAL_StatusTypeDef USB_HostInit(USB_OTG_GlobalTypeDef *USBx, USB_OTG_CfgTypeDef cfg);
 HAL_StatusTypeDef USB_InitFSLSPClkSel(USB_OTG_GlobalTypeDef *USBx, uint8_t freq);
 HAL_StatusTypeDef USB_ResetPort(USB_OTG_GlobalTypeDef *USBx);
+HAL_StatusTypeDef USB_ResetPort2(USB_OTG_GlobalTypeDef *USBx, uint32_t resetActiveState);
 HAL_StatusTypeDef USB_DriveVbus(USB_OTG_GlobalTypeDef *USBx, uint8_t state);
 uint32_t          USB_GetHostSpeed(USB_OTG_GlobalTypeDef *USBx);
 uint32_t          USB_GetCurrentFrame(USB_OTG_GlobalTypeDef *USBx);
@@ -502,6 +507,7 @@ HAL_StatusTypeDef USB_HC_Init(USB_OTG_GlobalTypeDef *USBx, uint8_t ch_num,
                               uint8_t ep_type, uint16_t mps);
 HAL_StatusTypeDef USB_HC_StartXfer(USB_OTG_GlobalTypeDef *USBx,
                                    USB_OTG_HCTypeDef *hc, uint8_t dma);
+uint32_t          USB_HC_WriteTxFifo(USB_OTG_GlobalTypeDef *USBx, USB_OTG_HCTypeDef *hc);
 
 uint32_t          USB_HC_ReadInterrupt(USB_OTG_GlobalTypeDef *USBx);
 HAL_StatusTypeDef USB_HC_Halt(USB_OTG_GlobalTypeDef *USBx, uint8_t hc_num);
@@ -78,7 +78,9 @@
   */
 static void HCD_HC_IN_IRQHandler(HCD_HandleTypeDef *hhcd, uint8_t chnum);
 static void HCD_HC_OUT_IRQHandler(HCD_HandleTypeDef *hhcd, uint8_t chnum);
+static void HCD_HC_OUT_Resume(HCD_HandleTypeDef *hhcd, uint8_t chnum);
 static void HCD_RXQLVL_IRQHandler(HCD_HandleTypeDef *hhcd);
+static void HCD_NPTXFE_IRQHandler(HCD_HandleTypeDef *hhcd);
 static void HCD_Port_IRQHandler(HCD_HandleTypeDef *hhcd);
 /**
   * @}
@@ -477,6 +479,8 @@ HAL_StatusTypeDef HAL_HCD_HC_SubmitRequest(HCD_HandleTypeDef *hhcd,
 
   hhcd->hc[ch_num].xfer_buff = pbuff;
   hhcd->hc[ch_num].xfer_len  = length;
+  hhcd->hc[ch_num].urb_buff = pbuff;
+  hhcd->hc[ch_num].urb_len = length;
   hhcd->hc[ch_num].urb_state = URB_IDLE;
   hhcd->hc[ch_num].xfer_count = 0U;
   hhcd->hc[ch_num].ch_num = ch_num;
@@ -581,6 +585,13 @@ void HAL_HCD_IRQHandler(HCD_HandleTypeDef *hhcd)
       USB_UNMASK_INTERRUPT(hhcd->Instance, USB_OTG_GINTSTS_RXFLVL);
     }
 
+    /* Handle Non-Periodic TxFIFO Empty Interrupt */
+    if (((USBx->GINTMSK & USB_OTG_GINTMSK_NPTXFEM) != 0U) &&
+        (__HAL_HCD_GET_FLAG(hhcd, USB_OTG_GINTSTS_NPTXFE)))
+    {
+      HCD_NPTXFE_IRQHandler(hhcd);
+    }
+
     /* Handle Host channel Interrupt */
     if (__HAL_HCD_GET_FLAG(hhcd, USB_OTG_GINTSTS_HCINT))
     {
@@ -1060,6 +1071,17 @@ HAL_StatusTypeDef HAL_HCD_ResetPort(HCD_HandleTypeDef *hhcd)
   return (USB_ResetPort(hhcd->Instance));
 }
 
+/**
+  * @brief  Drive or release the reset of the host port.
+  * @param  hhcd HCD handle
+  * @param  resetActiveState 1 to drive the reset, 0 to release it
+  * @retval HAL status
+  */
+HAL_StatusTypeDef HAL_HCD_ResetPort2(HCD_HandleTypeDef *hhcd, uint32_t resetActiveState)
+{
+  return (USB_ResetPort2(hhcd->Instance, resetActiveState));
+}
+
 /**
   * @}
   */
@@ -1492,7 +1514,13 @@ static void HCD_HC_OUT_IRQHandler(HCD_HandleTypeDef *hhcd, uint8_t chnum)
       {
         if (hhcd->Init.dma_enable == 0U)
         {
-          hhcd->hc[ch_num].toggle_out ^= 1U;
+          num_packets = (hhcd->hc[ch_num].XferSize + hhcd->hc[ch_num].max_packet - 1U) / hhcd->hc[ch_num].max_packet;
+
+          /* a zero length packet is still one packet */
+          if (((num_packets & 1U) != 0U) || (num_packets == 0U))
+          {
+            hhcd->hc[ch_num].toggle_out ^= 1U;
+          }
         }
 
         if ((hhcd->Init.dma_enable == 1U) && (hhcd->hc[ch_num].xfer_len > 0U))
@@ -1506,6 +1534,17 @@ static void HCD_HC_OUT_IRQHandler(HCD_HandleTypeDef *hhcd, uint8_t chnum)
         }
       }
     }
+    else if ((hhcd->hc[ch_num].state == HC_NAK) &&
+             (hhcd->hc[ch_num].ep_type == EP_TYPE_BULK) &&
+             (hhcd->Init.dma_enable == 0U) &&
+             ((hhcd->hc[ch_num].urb_len > hhcd->hc[ch_num].max_packet) ||
+              ((hhcd->hc[ch_num].xfer_buff - hhcd->hc[ch_num].xfer_count) != hhcd->hc[ch_num].urb_buff)))
+    {
+      /* multi-packet URB, or one already resumed: resume after the packets
+         the device accepted. The class resends a NOTREADY URB from its
+         start, which would duplicate them */
+      HCD_HC_OUT_Resume(hhcd, (uint8_t)ch_num);
+    }
     else if (hhcd->hc[ch_num].state == HC_NAK)
     {
       hhcd->hc[ch_num].urb_state = URB_NOTREADY;
@@ -1557,6 +1596,77 @@ static void HCD_HC_OUT_IRQHandler(HCD_HandleTypeDef *hhcd, uint8_t chnum)
   }
 }
 
+/**
+  * @brief  Restart an OUT URB interrupted by a NAK after its acked packets.
+  * @param  hhcd HCD handle
+  * @param  chnum Channel number.
+  *         This parameter can be a value from 1 to 15
+  * @retval none
+  */
+static void HCD_HC_OUT_Resume(HCD_HandleTypeDef *hhcd, uint8_t chnum)
+{
+  USB_OTG_GlobalTypeDef *USBx = hhcd->Instance;
+  uint32_t USBx_BASE = (uint32_t)USBx;
+  uint32_t ch_num = (uint32_t)chnum;
+  uint32_t hctsiz = USBx_HC(ch_num)->HCTSIZ;
+  uint32_t num_packets;
+  uint32_t acked;
+
+  /* the packets still counted in HCTSIZ were not acknowledged */
+  num_packets = (hhcd->hc[ch_num].XferSize + hhcd->hc[ch_num].max_packet - 1U) / hhcd->hc[ch_num].max_packet;
+  acked = (num_packets - ((hctsiz & USB_OTG_HCTSIZ_PKTCNT) >> 19)) * hhcd->hc[ch_num].max_packet;
+  if (acked > hhcd->hc[ch_num].XferSize)
+  {
+    acked = hhcd->hc[ch_num].XferSize;
+  }
+
+  /* drop the packets of this channel left in the Tx FIFO, if any, and
+     rewind the buffer. The FIFO is shared: it is not flushed when all the
+     data written by this channel was sent */
+  if (hhcd->hc[ch_num].xfer_count > acked)
+  {
+    (void)USB_FlushTxFifo(USBx, 0U);
+  }
+  hhcd->hc[ch_num].xfer_buff -= hhcd->hc[ch_num].xfer_count - acked;
+  hhcd->hc[ch_num].xfer_len = hhcd->hc[ch_num].XferSize - acked;
+
+  /* the core keeps the data toggle of the next packet */
+  hhcd->hc[ch_num].data_pid = (uint8_t)((hctsiz & USB_OTG_HCTSIZ_DPID) >> 29);
+  hhcd->hc[ch_num].toggle_out = (hhcd->hc[ch_num].data_pid == HC_PID_DATA1) ? 1U : 0U;
+
+  (void)USB_HC_StartXfer(USBx, &hhcd->hc[ch_num], 0U);
+}
+
+/**
+  * @brief  Handle Non-Periodic TxFIFO Empty interrupt requests.
+  * @param  hhcd HCD handle
+  * @retval none
+  */
+static void HCD_NPTXFE_IRQHandler(HCD_HandleTypeDef *hhcd)
+{
+  USB_OTG_GlobalTypeDef *USBx = hhcd->Instance;
+  uint32_t USBx_BASE = (uint32_t)USBx;
+  uint32_t remaining = 0U;
+  uint32_t i;
+
+  for (i = 0U; i < hhcd->Init.Host_channels; i++)
+  {
+    if ((hhcd->hc[i].ep_is_in == 0U) &&
+        ((hhcd->hc[i].ep_type == EP_TYPE_CTRL) || (hhcd->hc[i].ep_type == EP_TYPE_BULK)) &&
+        ((USBx_HC(i)->HCCHAR & USB_OTG_HCCHAR_CHENA) != 0U) &&
+        (hhcd->hc[i].xfer_count < hhcd->hc[i].XferSize))
+    {
+      remaining += USB_HC_WriteTxFifo(USBx, &hhcd->hc[i]);
+    }
+  }
+
+  if (remaining == 0U)
+  {
+    /* all the pending data is in the FIFO */
+    USBx->GINTMSK &= ~USB_OTG_GINTMSK_NPTXFEM;
+  }
+}
+
 /**
   * @brief  Handle Rx Queue Level interrupt requests.
   * @param  hhcd HCD handle
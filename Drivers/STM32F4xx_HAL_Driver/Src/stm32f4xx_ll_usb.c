@@ -1072,19 +1072,46 @@ HAL_StatusTypeDef USB_WritePacket(USB_OTG_GlobalTypeDef *USBx, uint8_t *src,
 {
   uint32_t USBx_BASE = (uint32_t)USBx;
   uint8_t *pSrc = src;
+  const uint32_t *pSrc32;
+  __IO uint32_t *pFifo;
   uint32_t count32b;
   uint32_t i;
 
   if (dma == 0U)
   {
     count32b = ((uint32_t)len + 3U) / 4U;
-    for (i = 0U; i < count32b; i++)
+
+    if (((uint32_t)pSrc & 3U) == 0U)
+    {
+      /* Word aligned buffer: push four words per iteration */
+      pSrc32 = (const uint32_t *)pSrc;
+      pFifo = &USBx_DFIFO((uint32_t)ch_ep_num);
+
+      for (i = count32b >> 2; i != 0U; i--)
+      {
+        *pFifo = pSrc32[0];
+        *pFifo = pSrc32[1];
+        *pFifo = pSrc32[2];
+        *pFifo = pSrc32[3];
+        pSrc32 += 4;
+      }
+
+      for (i = count32b & 3U; i != 0U; i--)
+      {
+        *pFifo = *pSrc32;
+        pSrc32++;
+      }
+    }
+    else
     {
-      USBx_DFIFO((uint32_t)ch_ep_num) = __UNALIGNED_UINT32_READ(pSrc);
-      pSrc++;
-      pSrc++;
-      pSrc++;
-      pSrc++;
+      for (i = 0U; i < count32b; i++)
+      {
+        USBx_DFIFO((uint32_t)ch_ep_num) = __UNALIGNED_UINT32_READ(pSrc);
+        pSrc++;
+        pSrc++;
+        pSrc++;
+        pSrc++;
+      }
     }
   }
 
@@ -1102,18 +1129,46 @@ void *USB_ReadPacket(USB_OTG_GlobalTypeDef *USBx, uint8_t *dest, uint16_t len)
 {
   uint32_t USBx_BASE = (uint32_t)USBx;
   uint8_t *pDest = dest;
+  uint32_t *pDest32;
+  __IO uint32_t *pFifo;
   uint32_t pData;
   uint32_t i;
   uint32_t count32b = (uint32_t)len >> 2U;
   uint16_t remaining_bytes = len % 4U;
 
-  for (i = 0U; i < count32b; i++)
+  if (((uint32_t)pDest & 3U) == 0U)
   {
-    __UNALIGNED_UINT32_WRITE(pDest, USBx_DFIFO(0U));
-    pDest++;
-    pDest++;
-    pDest++;
-    pDest++;
+    /* Word aligned buffer: pop four words per iteration */
+    pDest32 = (uint32_t *)pDest;
+    pFifo = &USBx_DFIFO(0U);
+
+    for (i = count32b >> 2; i != 0U; i--)
+    {
+      pDest32[0] = *pFifo;
+      pDest32[1] = *pFifo;
+      pDest32[2] = *pFifo;
+      pDest32[3] = *pFifo;
+      pDest32 += 4;
+    }
+
+    for (i = count32b & 3U; i != 0U; i--)
+    {
+      *pDest32 = *pFifo;
+      pDest32++;
+    }
+
+    pDest = (uint8_t *)pDest32;
+  }
+  else
+  {
+    for (i = 0U; i < count32b; i++)
+    {
+      __UNALIGNED_UINT32_WRITE(pDest, USBx_DFIFO(0U));
+      pDest++;
+      pDest++;
+      pDest++;
+      pDest++;
+    }
   }
 
   /* When Number of data is not word aligned, read the remaining byte */
@@ -1653,6 +1708,40 @@ HAL_StatusTypeDef USB_ResetPort(USB_OTG_GlobalTypeDef *USBx)
   return HAL_OK;
 }
 
+/**
+  * @brief  USB_ResetPort2 : Drive or release the reset of the Host Port
+  * @param  USBx  Selected device
+  * @param  resetActiveState  Reset state
+  *          This parameter can be one of these values:
+  *           0 : Release the reset
+  *           1 : Drive the reset
+  * @retval HAL status
+  * @note (1)Unlike USB_ResetPort the call returns at once, the application
+  *   times the reset (at least 10 ms) and the recovery after it.
+  */
+HAL_StatusTypeDef USB_ResetPort2(USB_OTG_GlobalTypeDef *USBx, uint32_t resetActiveState)
+{
+  uint32_t USBx_BASE = (uint32_t)USBx;
+
+  __IO uint32_t hprt0 = 0U;
+
+  hprt0 = USBx_HPRT0;
+
+  hprt0 &= ~(USB_OTG_HPRT_PENA | USB_OTG_HPRT_PCDET |
+             USB_OTG_HPRT_PENCHNG | USB_OTG_HPRT_POCCHNG);
+
+  if (resetActiveState == 0U)
+  {
+    USBx_HPRT0 = ((~USB_OTG_HPRT_PRST) & hprt0);
+  }
+  else
+  {
+    USBx_HPRT0 = (USB_OTG_HPRT_PRST | hprt0);
+  }
+
+  return HAL_OK;
+}
+
 /**
   * @brief  USB_DriveVbus : activate or de-activate vbus
   * @param  state  VBUS state
@@ -1870,7 +1959,7 @@ HAL_StatusTypeDef USB_HC_StartXfer(USB_OTG_GlobalTypeDef *USBx, USB_OTG_HCTypeDe
   uint8_t  is_oddframe;
   uint16_t len_words;
   uint16_t num_packets;
-  uint16_t max_hc_pkt_count = 256U;
+  uint16_t max_hc_pkt_count = (uint16_t)(USB_OTG_HCTSIZ_PKTCNT >> 19);
 
   if (((USBx->CID & (0x1U << 8)) != 0U) && (hc->speed == USBH_HS_SPEED))
   {
@@ -1914,6 +2003,10 @@ HAL_StatusTypeDef USB_HC_StartXfer(USB_OTG_GlobalTypeDef *USBx, USB_OTG_HCTypeDe
   {
     hc->XferSize = (uint32_t)num_packets * hc->max_packet;
   }
+  else if (hc->xfer_len > ((uint32_t)num_packets * hc->max_packet))
+  {
+    hc->XferSize = (uint32_t)num_packets * hc->max_packet;
+  }
   else
   {
     hc->XferSize = hc->xfer_len;
@@ -1963,15 +2056,14 @@ HAL_StatusTypeDef USB_HC_StartXfer(USB_OTG_GlobalTypeDef *USBx, USB_OTG_HCTypeDe
       case EP_TYPE_CTRL:
       case EP_TYPE_BULK:
 
-        len_words = (uint16_t)((hc->xfer_len + 3U) / 4U);
-
-        /* check if there is enough space in FIFO space */
-        if (len_words > (USBx->HNPTXSTS & 0xFFFFU))
+        /* Write the packets which fit into the Tx FIFO */
+        hc->xfer_count = 0U;
+        if (USB_HC_WriteTxFifo(USBx, hc) != 0U)
         {
           /* need to process data in nptxfempty interrupt */
           USBx->GINTMSK |= USB_OTG_GINTMSK_NPTXFEM;
         }
-        break;
+        return HAL_OK;
 
       /* Periodic transfer */
       case EP_TYPE_INTR:
@@ -1996,6 +2088,40 @@ HAL_StatusTypeDef USB_HC_StartXfer(USB_OTG_GlobalTypeDef *USBx, USB_OTG_HCTypeDe
   return HAL_OK;
 }
 
+/**
+  * @brief  Write into the non periodic Tx FIFO the packets of an OUT transfer
+  *         for which there is room in the FIFO and in the request queue
+  * @note   hc->xfer_buff and hc->xfer_count track the data already written
+  * @param  USBx  Selected device
+  * @param  hc  pointer to host channel structure
+  * @retval number of bytes of the transfer still to be written
+  */
+uint32_t USB_HC_WriteTxFifo(USB_OTG_GlobalTypeDef *USBx, USB_OTG_HCTypeDef *hc)
+{
+  uint32_t remaining = hc->XferSize - hc->xfer_count;
+  uint32_t txsts;
+  uint32_t len;
+
+  while (remaining > 0U)
+  {
+    len = (remaining > hc->max_packet) ? hc->max_packet : remaining;
+    txsts = USBx->HNPTXSTS;
+
+    if ((((len + 3U) / 4U) > (txsts & USB_OTG_GNPTXSTS_NPTXFSAV)) ||
+        ((txsts & USB_OTG_GNPTXSTS_NPTQXSAV) == 0U))
+    {
+      break;
+    }
+
+    (void)USB_WritePacket(USBx, hc->xfer_buff, hc->ch_num, (uint16_t)len, 0U);
+    hc->xfer_buff += len;
+    hc->xfer_count += len;
+    remaining -= len;
+  }
+
+  return remaining;
+}
+
 /**
   * @brief Read all host channel interrupts status
   * @param  USBx  Selected device
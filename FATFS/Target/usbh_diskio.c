@@ -21,10 +21,21 @@
 /* USER CODE END firstSection */
 
 /* Includes ------------------------------------------------------------------*/
+#include <string.h>
 #include "ff_gen_drv.h"
 #include "usbh_diskio.h"
 
 /* Private typedef -----------------------------------------------------------*/
+#if (USBH_CACHE_LINES > 0U)
+typedef struct
+{
+  uint8_t  Valid;
+  BYTE     Lun;
+  DWORD    Lba;     /* first sector of the line */
+  uint32_t Stamp;   /* last use, for LRU replacement */
+} USBH_CacheLineTypeDef;
+#endif /* USBH_CACHE_LINES > 0U */
+
 /* Private define ------------------------------------------------------------*/
 
 #define USB_DEFAULT_BLOCK_SIZE 512
@@ -32,7 +43,17 @@
 /* Private variables ---------------------------------------------------------*/
 extern USBH_HandleTypeDef  hUSB_Host;
 
+#if (USBH_CACHE_LINES > 0U)
+static USBH_CacheLineTypeDef CacheLine[USBH_CACHE_LINES];
+static BYTE CacheData[USBH_CACHE_LINES][USBH_CACHE_LINE_SECTORS * USB_DEFAULT_BLOCK_SIZE] __ALIGNED(4);
+static uint32_t CacheClock;
+#endif /* USBH_CACHE_LINES > 0U */
+
 /* Private function prototypes -----------------------------------------------*/
+#if (USBH_CACHE_LINES > 0U)
+static USBH_StatusTypeDef USBH_CacheRead(BYTE lun, BYTE *buff, DWORD sector);
+static void USBH_CacheUpdate(BYTE lun, const BYTE *buff, DWORD sector, UINT count);
+#endif /* USBH_CACHE_LINES > 0U */
 DSTATUS USBH_initialize (BYTE);
 DSTATUS USBH_status (BYTE);
 DRESULT USBH_read (BYTE, BYTE*, DWORD, UINT);
@@ -73,6 +94,11 @@ DSTATUS USBH_initialize(BYTE lun)
 {
   /* CAUTION : USB Host library has to be initialized in the application */
 
+#if (USBH_CACHE_LINES > 0U)
+  /* the medium may have been changed */
+  memset(CacheLine, 0, sizeof(CacheLine));
+#endif /* USBH_CACHE_LINES > 0U */
+
   return RES_OK;
 }
 
@@ -113,8 +139,22 @@ DRESULT USBH_read(BYTE lun, BYTE *buff, DWORD sector, UINT count)
 {
   DRESULT res = RES_ERROR;
   MSC_LUNTypeDef info;
+  USBH_StatusTypeDef status;
+
+#if (USBH_CACHE_LINES > 0U)
+  /* FAT, directory and partial sector reads go through the cache, multiple
+     sector reads are file data and go straight to the caller buffer */
+  if(count == 1U)
+  {
+    status = USBH_CacheRead(lun, buff, sector);
+  }
+  else
+#endif /* USBH_CACHE_LINES > 0U */
+  {
+    status = USBH_MSC_Read(&hUSB_Host, lun, sector, buff, count);
+  }
 
-  if(USBH_MSC_Read(&hUSB_Host, lun, sector, buff, count) == USBH_OK)
+  if(status == USBH_OK)
   {
     res = RES_OK;
   }
@@ -160,6 +200,10 @@ DRESULT USBH_write(BYTE lun, const BYTE *buff, DWORD sector, UINT count)
 
   if(USBH_MSC_Write(&hUSB_Host, lun, sector, (BYTE *)buff, count) == USBH_OK)
   {
+#if (USBH_CACHE_LINES > 0U)
+    /* write-through: keep the cached copies up to date */
+    USBH_CacheUpdate(lun, buff, sector, count);
+#endif /* USBH_CACHE_LINES > 0U */
     res = RES_OK;
   }
   else
@@ -262,6 +306,102 @@ DRESULT USBH_ioctl(BYTE lun, BYTE cmd, void *buff)
 }
 #endif /* _USE_IOCTL == 1 */
 
+#if (USBH_CACHE_LINES > 0U)
+/**
+  * @brief  Reads one sector through the cache
+  * @param  lun : lun id
+  * @param  *buff: Data buffer to store read data
+  * @param  sector: Sector address (LBA)
+  * @retval USBH Status
+  */
+static USBH_StatusTypeDef USBH_CacheRead(BYTE lun, BYTE *buff, DWORD sector)
+{
+  MSC_LUNTypeDef info;
+  USBH_StatusTypeDef status;
+  DWORD lba = sector - (sector % USBH_CACHE_LINE_SECTORS);
+  uint32_t idx;
+  uint32_t victim = 0U;
+
+  for(idx = 0U; idx < USBH_CACHE_LINES; idx++)
+  {
+    if((CacheLine[idx].Valid != 0U) && (CacheLine[idx].Lun == lun) && (CacheLine[idx].Lba == lba))
+    {
+      break;
+    }
+
+    /* an invalid line is the best victim, otherwise the least recently used */
+    if((CacheLine[victim].Valid != 0U) &&
+       ((CacheLine[idx].Valid == 0U) || (CacheLine[idx].Stamp < CacheLine[victim].Stamp)))
+    {
+      victim = idx;
+    }
+  }
+
+  if(idx == USBH_CACHE_LINES)
+  {
+    /* the line must lie within the medium and match the sector size */
+    if((USBH_MSC_GetLUNInfo(&hUSB_Host, lun, &info) != USBH_OK) ||
+       (info.capacity.block_size != USB_DEFAULT_BLOCK_SIZE) ||
+       ((lba + USBH_CACHE_LINE_SECTORS) > info.capacity.block_nbr))
+    {
+      return USBH_MSC_Read(&hUSB_Host, lun, sector, buff, 1U);
+    }
+
+    idx = victim;
+    CacheLine[idx].Valid = 0U;
+
+    status = USBH_MSC_Read(&hUSB_Host, lun, lba, CacheData[idx], USBH_CACHE_LINE_SECTORS);
+    if(status != USBH_OK)
+    {
+      return status;
+    }
+
+    CacheLine[idx].Valid = 1U;
+    CacheLine[idx].Lun = lun;
+    CacheLine[idx].Lba = lba;
+  }
+
+  CacheLine[idx].Stamp = ++CacheClock;
+  memcpy(buff, &CacheData[idx][(sector - lba) * USB_DEFAULT_BLOCK_SIZE], USB_DEFAULT_BLOCK_SIZE);
+
+  return USBH_OK;
+}
+
+/**
+  * @brief  Copies written sectors into the cache lines holding them
+  * @param  lun : lun id
+  * @param  *buff: Data written
+  * @param  sector: Sector address (LBA)
+  * @param  count: Number of sectors written
+  * @retval None
+  */
+static void USBH_CacheUpdate(BYTE lun, const BYTE *buff, DWORD sector, UINT count)
+{
+  uint32_t idx;
+  DWORD first;
+  DWORD last;
+
+  for(idx = 0U; idx < USBH_CACHE_LINES; idx++)
+  {
+    if((CacheLine[idx].Valid == 0U) || (CacheLine[idx].Lun != lun))
+    {
+      continue;
+    }
+
+    /* overlap of [sector, sector + count) with the line */
+    first = MAX(sector, CacheLine[idx].Lba);
+    last = MIN(sector + count, CacheLine[idx].Lba + USBH_CACHE_LINE_SECTORS);
+
+    if(first < last)
+    {
+      memcpy(&CacheData[idx][(first - CacheLine[idx].Lba) * USB_DEFAULT_BLOCK_SIZE],
+             &buff[(first - sector) * USB_DEFAULT_BLOCK_SIZE],
+             (last - first) * USB_DEFAULT_BLOCK_SIZE);
+    }
+  }
+}
+#endif /* USBH_CACHE_LINES > 0U */
+
 /* USER CODE BEGIN lastSection */
 /* can be used to modify / undefine previous code or add new code */
 /* USER CODE END lastSection */
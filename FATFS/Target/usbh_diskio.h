@@ -29,6 +29,15 @@
 #include "usbh_msc.h"
 /* Exported types ------------------------------------------------------------*/
 /* Exported constants --------------------------------------------------------*/
+/* Sector cache: number of lines and of consecutive sectors per line. A single
+   sector miss reads the whole aligned line (read-ahead); 0 lines disables it */
+#ifndef USBH_CACHE_LINES
+#define USBH_CACHE_LINES              4U
+#endif
+#ifndef USBH_CACHE_LINE_SECTORS
+#define USBH_CACHE_LINE_SECTORS       4U
+#endif
+
 /* Exported functions ------------------------------------------------------- */
 extern const Diskio_drvTypeDef  USBH_Driver;
 
@@ -64,6 +64,7 @@ typedef enum
   MSC_WRITE,
   MSC_UNRECOVERED_ERROR,
   MSC_PERIODIC_CHECK,
+  MSC_READ_BLOCK_LIMITS,
 }
 MSC_StateTypeDef;
 
@@ -89,6 +90,21 @@ MSC_ReqStateTypeDef;
 #define MAX_SUPPORTED_LUN       2U
 #endif
 
+/* Largest data phase of one READ(10)/WRITE(10) command, longer Read/Write
+   requests are split */
+#ifndef USBH_MSC_MAX_TRANSFER_SIZE
+#define USBH_MSC_MAX_TRANSFER_SIZE    65536U
+#endif
+
+/* Read/Write timeout: fixed allowance for the device latency plus the time
+   the data takes at the lowest expected rate, in bytes per ms (KB/s) */
+#ifndef USBH_MSC_RW_TIMEOUT_BASE
+#define USBH_MSC_RW_TIMEOUT_BASE      5000U
+#endif
+#ifndef USBH_MSC_RW_MIN_RATE
+#define USBH_MSC_RW_MIN_RATE          64U
+#endif
+
 
 /* Structure for LUN */
 typedef struct
@@ -99,6 +115,7 @@ typedef struct
   SCSI_CapacityTypeDef        capacity;
   SCSI_SenseTypeDef           sense;
   SCSI_StdInquiryDataTypeDef  inquiry;
+  SCSI_BlockLimitsTypeDef     block_limits;
   uint8_t                     state_changed;
 
 }
@@ -124,6 +141,8 @@ typedef struct _MSC_Process
   uint16_t             current_lun;
   uint16_t             rw_lun;
   uint32_t             timer;
+  uint32_t             rw_timer;
+  uint32_t             rw_timeout;
 }
 MSC_HandleTypeDef;
 
@@ -179,11 +198,26 @@ uint8_t USBH_MSC_UnitIsReady(USBH_HandleTypeDef *phost, uint8_t lun);
 USBH_StatusTypeDef USBH_MSC_GetLUNInfo(USBH_HandleTypeDef *phost, uint8_t lun,
                                        MSC_LUNTypeDef *info);
 
+USBH_StatusTypeDef USBH_MSC_GetBlockLimits(USBH_HandleTypeDef *phost, uint8_t lun,
+                                           SCSI_BlockLimitsTypeDef *limits);
+
 USBH_StatusTypeDef USBH_MSC_Read(USBH_HandleTypeDef *phost, uint8_t lun,
                                  uint32_t address, uint8_t *pbuf, uint32_t length);
 
 USBH_StatusTypeDef USBH_MSC_Write(USBH_HandleTypeDef *phost, uint8_t lun,
                                   uint32_t address, uint8_t *pbuf, uint32_t length);
+
+USBH_StatusTypeDef USBH_MSC_SubmitRead(USBH_HandleTypeDef *phost, uint8_t lun,
+                                       uint32_t address, uint8_t *pbuf, uint32_t length);
+
+USBH_StatusTypeDef USBH_MSC_SubmitWrite(USBH_HandleTypeDef *phost, uint8_t lun,
+                                        uint32_t address, uint8_t *pbuf, uint32_t length);
+
+USBH_StatusTypeDef USBH_MSC_PollTransfer(USBH_HandleTypeDef *phost, uint8_t lun);
+
+void USBH_MSC_RdWrIdleCallback(USBH_HandleTypeDef *phost);
+void USBH_MSC_TransferCpltCallback(USBH_HandleTypeDef *phost, uint8_t lun,
+                                   USBH_StatusTypeDef status);
 /**
   * @}
   */
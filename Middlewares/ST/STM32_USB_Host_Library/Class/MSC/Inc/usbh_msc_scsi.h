@@ -74,6 +74,13 @@ typedef struct
   uint8_t revision_id[5];
 } SCSI_StdInquiryDataTypeDef;
 
+/* Block Limits VPD page, in logical blocks (0: not reported) */
+typedef struct
+{
+  uint32_t max_transfer;
+  uint32_t opt_transfer;
+} SCSI_BlockLimitsTypeDef;
+
 /** @defgroup USBH_MSC_SCSI_Exported_Defines
   * @{
   */
@@ -88,6 +95,10 @@ typedef struct
 #define DATA_LEN_READ_CAPACITY10             8U
 #define DATA_LEN_INQUIRY                    36U
 #define DATA_LEN_REQUEST_SENSE              14U
+#define DATA_LEN_BLOCK_LIMITS               64U
+
+#define INQUIRY_EVPD                      0x01U
+#define VPD_PAGE_BLOCK_LIMITS             0xB0U
 
 #define CBW_CB_LENGTH                       16U
 #define CBW_LENGTH                          10U
@@ -174,6 +185,10 @@ USBH_StatusTypeDef USBH_MSC_SCSI_RequestSense(USBH_HandleTypeDef *phost,
                                               uint8_t lun,
                                               SCSI_SenseTypeDef *sense_data);
 
+USBH_StatusTypeDef USBH_MSC_SCSI_BlockLimits(USBH_HandleTypeDef *phost,
+                                             uint8_t lun,
+                                             SCSI_BlockLimitsTypeDef *limits);
+
 USBH_StatusTypeDef USBH_MSC_SCSI_Write(USBH_HandleTypeDef *phost,
                                        uint8_t lun,
                                        uint32_t address,
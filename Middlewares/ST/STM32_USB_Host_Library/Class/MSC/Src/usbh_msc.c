@@ -106,6 +106,9 @@ static USBH_StatusTypeDef USBH_MSC_SOFProcess(USBH_HandleTypeDef *phost);
 
 static USBH_StatusTypeDef USBH_MSC_RdWrProcess(USBH_HandleTypeDef *phost, uint8_t lun);
 
+static uint32_t USBH_MSC_MaxTransferBlocks(MSC_HandleTypeDef *MSC_Handle, uint8_t lun);
+static uint32_t USBH_MSC_RdWrTimeout(MSC_HandleTypeDef *MSC_Handle, uint8_t lun, uint32_t length);
+
 USBH_ClassTypeDef  USBH_msc =
 {
   "MSC",
@@ -758,6 +761,67 @@ USBH_StatusTypeDef USBH_MSC_GetLUNInfo(USBH_HandleTypeDef *phost, uint8_t lun, M
   }
 }
 
+/**
+  * @brief  USBH_MSC_GetBlockLimits
+  *         The function reads the transfer lengths the unit reports in its
+  *         Block Limits VPD page. A maximum transfer length then also bounds
+  *         the commands of USBH_MSC_Read/USBH_MSC_Write.
+  * @note   Not every mass storage device implements VPD pages: on failure
+  *         the limits are left unknown and the defaults apply.
+  * @param  phost: Host handle
+  * @param  lun: logical Unit Number
+  * @param  limits: receives the transfer lengths, in blocks (0: not reported)
+  * @retval USBH Status
+  */
+USBH_StatusTypeDef USBH_MSC_GetBlockLimits(USBH_HandleTypeDef *phost,
+                                           uint8_t lun,
+                                           SCSI_BlockLimitsTypeDef *limits)
+{
+  MSC_HandleTypeDef *MSC_Handle = (MSC_HandleTypeDef *) phost->pActiveClass->pData;
+  USBH_StatusTypeDef status;
+  uint32_t timeout = phost->Timer;
+
+  if ((phost->device.is_connected == 0U) ||
+      (phost->gState != HOST_CLASS) ||
+      (MSC_Handle->unit[lun].state != MSC_IDLE))
+  {
+    return  USBH_FAIL;
+  }
+
+  MSC_Handle->unit[lun].state = MSC_READ_BLOCK_LIMITS;
+  (void)USBH_memset(&MSC_Handle->unit[lun].block_limits, 0, sizeof(SCSI_BlockLimitsTypeDef));
+
+  do
+  {
+    status = USBH_MSC_SCSI_BlockLimits(phost, lun, &MSC_Handle->unit[lun].block_limits);
+
+    if (((phost->Timer - timeout) > USBH_MSC_RW_TIMEOUT_BASE) || (phost->device.is_connected == 0U))
+    {
+      status = USBH_FAIL;
+    }
+  } while (status == USBH_BUSY);
+
+  if (status == USBH_UNRECOVERED_ERROR)
+  {
+    MSC_Handle->unit[lun].state = MSC_UNRECOVERED_ERROR;
+    return USBH_FAIL;
+  }
+
+  MSC_Handle->unit[lun].state = MSC_IDLE;
+
+  if (status != USBH_OK)
+  {
+    /* The command failed or timed out: the limits stay unknown */
+    (void)USBH_memset(&MSC_Handle->unit[lun].block_limits, 0, sizeof(SCSI_BlockLimitsTypeDef));
+    MSC_Handle->hbot.cmd_state = BOT_CMD_SEND;
+    return USBH_FAIL;
+  }
+
+  (void)USBH_memcpy(limits, &MSC_Handle->unit[lun].block_limits, sizeof(SCSI_BlockLimitsTypeDef));
+
+  return USBH_OK;
+}
+
 /**
   * @brief  USBH_MSC_Read
   *         The function performs a Read operation
@@ -774,35 +838,31 @@ USBH_StatusTypeDef USBH_MSC_Read(USBH_HandleTypeDef *phost,
                                  uint8_t *pbuf,
                                  uint32_t length)
 {
-  uint32_t timeout;
   MSC_HandleTypeDef *MSC_Handle = (MSC_HandleTypeDef *) phost->pActiveClass->pData;
+  USBH_StatusTypeDef status = USBH_OK;
+  uint32_t count;
 
-  if ((phost->device.is_connected == 0U) ||
-      (phost->gState != HOST_CLASS) ||
-      (MSC_Handle->unit[lun].state != MSC_IDLE))
+  /* One command per USBH_MSC_MAX_TRANSFER_SIZE bytes at most */
+  while ((length > 0U) && (status == USBH_OK))
   {
-    return  USBH_FAIL;
-  }
-
-  MSC_Handle->state = MSC_READ;
-  MSC_Handle->unit[lun].state = MSC_READ;
-  MSC_Handle->rw_lun = lun;
+    count = MIN(length, USBH_MSC_MaxTransferBlocks(MSC_Handle, lun));
 
-  (void)USBH_MSC_SCSI_Read(phost, lun, address, pbuf, length);
-
-  timeout = phost->Timer;
+    if (USBH_MSC_SubmitRead(phost, lun, address, pbuf, count) != USBH_OK)
+    {
+      return  USBH_FAIL;
+    }
 
-  while (USBH_MSC_RdWrProcess(phost, lun) == USBH_BUSY)
-  {
-    if (((phost->Timer - timeout) > (10000U * length)) || (phost->device.is_connected == 0U))
+    while ((status = USBH_MSC_PollTransfer(phost, lun)) == USBH_BUSY)
     {
-      MSC_Handle->state = MSC_IDLE;
-      return USBH_FAIL;
+      USBH_MSC_RdWrIdleCallback(phost);
     }
+
+    address += count;
+    pbuf += count * MSC_Handle->unit[lun].capacity.block_size;
+    length -= count;
   }
-  MSC_Handle->state = MSC_IDLE;
 
-  return USBH_OK;
+  return status;
 }
 
 /**
@@ -821,12 +881,96 @@ USBH_StatusTypeDef USBH_MSC_Write(USBH_HandleTypeDef *phost,
                                   uint8_t *pbuf,
                                   uint32_t length)
 {
-  uint32_t timeout;
+  MSC_HandleTypeDef *MSC_Handle = (MSC_HandleTypeDef *) phost->pActiveClass->pData;
+  USBH_StatusTypeDef status = USBH_OK;
+  uint32_t count;
+
+  /* One command per USBH_MSC_MAX_TRANSFER_SIZE bytes at most */
+  while ((length > 0U) && (status == USBH_OK))
+  {
+    count = MIN(length, USBH_MSC_MaxTransferBlocks(MSC_Handle, lun));
+
+    if (USBH_MSC_SubmitWrite(phost, lun, address, pbuf, count) != USBH_OK)
+    {
+      return  USBH_FAIL;
+    }
+
+    while ((status = USBH_MSC_PollTransfer(phost, lun)) == USBH_BUSY)
+    {
+      USBH_MSC_RdWrIdleCallback(phost);
+    }
+
+    address += count;
+    pbuf += count * MSC_Handle->unit[lun].capacity.block_size;
+    length -= count;
+  }
+
+  return status;
+}
+
+/**
+  * @brief  USBH_MSC_SubmitRead
+  *         The function starts a Read operation and returns immediately,
+  *         the transfer is then driven by USBH_MSC_PollTransfer
+  * @param  phost: Host handle
+  * @param  lun: logical Unit Number
+  * @param  address: sector address
+  * @param  pbuf: pointer to data
+  * @param  length: number of sector to read, within the transfer size
+  *         limit of the unit
+  * @retval USBH Status
+  */
+USBH_StatusTypeDef USBH_MSC_SubmitRead(USBH_HandleTypeDef *phost,
+                                       uint8_t lun,
+                                       uint32_t address,
+                                       uint8_t *pbuf,
+                                       uint32_t length)
+{
   MSC_HandleTypeDef *MSC_Handle = (MSC_HandleTypeDef *) phost->pActiveClass->pData;
 
   if ((phost->device.is_connected == 0U) ||
       (phost->gState != HOST_CLASS) ||
-      (MSC_Handle->unit[lun].state != MSC_IDLE))
+      (MSC_Handle->unit[lun].state != MSC_IDLE) ||
+      (length > USBH_MSC_MaxTransferBlocks(MSC_Handle, lun)))
+  {
+    return  USBH_FAIL;
+  }
+
+  MSC_Handle->state = MSC_READ;
+  MSC_Handle->unit[lun].state = MSC_READ;
+  MSC_Handle->rw_lun = lun;
+  MSC_Handle->rw_timer = phost->Timer;
+  MSC_Handle->rw_timeout = USBH_MSC_RdWrTimeout(MSC_Handle, lun, length);
+
+  (void)USBH_MSC_SCSI_Read(phost, lun, address, pbuf, length);
+
+  return USBH_OK;
+}
+
+/**
+  * @brief  USBH_MSC_SubmitWrite
+  *         The function starts a Write operation and returns immediately,
+  *         the transfer is then driven by USBH_MSC_PollTransfer
+  * @param  phost: Host handle
+  * @param  lun: logical Unit Number
+  * @param  address: sector address
+  * @param  pbuf: pointer to data
+  * @param  length: number of sector to write, within the transfer size
+  *         limit of the unit
+  * @retval USBH Status
+  */
+USBH_StatusTypeDef USBH_MSC_SubmitWrite(USBH_HandleTypeDef *phost,
+                                        uint8_t lun,
+                                        uint32_t address,
+                                        uint8_t *pbuf,
+                                        uint32_t length)
+{
+  MSC_HandleTypeDef *MSC_Handle = (MSC_HandleTypeDef *) phost->pActiveClass->pData;
+
+  if ((phost->device.is_connected == 0U) ||
+      (phost->gState != HOST_CLASS) ||
+      (MSC_Handle->unit[lun].state != MSC_IDLE) ||
+      (length > USBH_MSC_MaxTransferBlocks(MSC_Handle, lun)))
   {
     return  USBH_FAIL;
   }
@@ -834,20 +978,132 @@ USBH_StatusTypeDef USBH_MSC_Write(USBH_HandleTypeDef *phost,
   MSC_Handle->state = MSC_WRITE;
   MSC_Handle->unit[lun].state = MSC_WRITE;
   MSC_Handle->rw_lun = lun;
+  MSC_Handle->rw_timer = phost->Timer;
+  MSC_Handle->rw_timeout = USBH_MSC_RdWrTimeout(MSC_Handle, lun, length);
 
   (void)USBH_MSC_SCSI_Write(phost, lun, address, pbuf, length);
 
-  timeout = phost->Timer;
-  while (USBH_MSC_RdWrProcess(phost, lun) == USBH_BUSY)
+  return USBH_OK;
+}
+
+/**
+  * @brief  USBH_MSC_PollTransfer
+  *         The function advances the BOT state machine of the transfer
+  *         started by USBH_MSC_SubmitRead/USBH_MSC_SubmitWrite
+  * @param  phost: Host handle
+  * @param  lun: logical Unit Number
+  * @retval USBH_BUSY while the transfer is in flight, otherwise the final
+  *         status, which is also reported to USBH_MSC_TransferCpltCallback
+  */
+USBH_StatusTypeDef USBH_MSC_PollTransfer(USBH_HandleTypeDef *phost, uint8_t lun)
+{
+  MSC_HandleTypeDef *MSC_Handle = (MSC_HandleTypeDef *) phost->pActiveClass->pData;
+  USBH_StatusTypeDef status;
+
+  if ((MSC_Handle->state != MSC_READ) && (MSC_Handle->state != MSC_WRITE))
+  {
+    return USBH_FAIL;
+  }
+
+  status = USBH_MSC_RdWrProcess(phost, lun);
+
+  if (status == USBH_BUSY)
   {
-    if (((phost->Timer - timeout) > (10000U * length)) || (phost->device.is_connected == 0U))
+    if (((phost->Timer - MSC_Handle->rw_timer) > MSC_Handle->rw_timeout) ||
+        (phost->device.is_connected == 0U))
     {
-      MSC_Handle->state = MSC_IDLE;
-      return USBH_FAIL;
+      status = USBH_FAIL;
+    }
+    else
+    {
+      return USBH_BUSY;
     }
   }
+
   MSC_Handle->state = MSC_IDLE;
-  return USBH_OK;
+  USBH_MSC_TransferCpltCallback(phost, lun, status);
+
+  return status;
+}
+
+/**
+  * @brief  USBH_MSC_MaxTransferBlocks
+  *         The function returns the number of blocks one READ(10)/WRITE(10)
+  *         command may carry
+  * @param  MSC_Handle: MSC handle
+  * @param  lun: logical Unit Number
+  * @retval Number of blocks
+  */
+static uint32_t USBH_MSC_MaxTransferBlocks(MSC_HandleTypeDef *MSC_Handle, uint8_t lun)
+{
+  uint32_t blocks = 0xFFFFU; /* 16-bit transfer length field */
+
+  if (MSC_Handle->unit[lun].capacity.block_size != 0U)
+  {
+    blocks = MIN(blocks, USBH_MSC_MAX_TRANSFER_SIZE / MSC_Handle->unit[lun].capacity.block_size);
+  }
+
+  if (MSC_Handle->unit[lun].block_limits.max_transfer != 0U)
+  {
+    blocks = MIN(blocks, MSC_Handle->unit[lun].block_limits.max_transfer);
+  }
+
+  return MAX(blocks, 1U);
+}
+
+/**
+  * @brief  USBH_MSC_RdWrTimeout
+  *         The function returns the time allowed for a read or write
+  *         command, derived from its size
+  * @param  MSC_Handle: MSC handle
+  * @param  lun: logical Unit Number
+  * @param  length: number of sectors
+  * @retval Timeout in ms
+  */
+static uint32_t USBH_MSC_RdWrTimeout(MSC_HandleTypeDef *MSC_Handle, uint8_t lun, uint32_t length)
+{
+  return USBH_MSC_RW_TIMEOUT_BASE +
+         ((length * MSC_Handle->unit[lun].capacity.block_size) / USBH_MSC_RW_MIN_RATE);
+}
+
+/**
+  * @brief  USBH_MSC_RdWrIdleCallback
+  *         Called on every poll of a blocking Read/Write while the BOT
+  *         transfer is in flight, so the caller can overlap its own work
+  *         with the bus transfer.
+  * @param  phost: Host handle
+  * @retval None
+  */
+__weak void USBH_MSC_RdWrIdleCallback(USBH_HandleTypeDef *phost)
+{
+  /* Prevent unused argument(s) compilation warning */
+  UNUSED(phost);
+
+  /* NOTE : This function should not be modified, when the callback is needed,
+            the USBH_MSC_RdWrIdleCallback could be implemented in the user file
+   */
+}
+
+/**
+  * @brief  USBH_MSC_TransferCpltCallback
+  *         Reports the end of a transfer started with USBH_MSC_SubmitRead or
+  *         USBH_MSC_SubmitWrite.
+  * @param  phost: Host handle
+  * @param  lun: logical Unit Number
+  * @param  status: USBH_OK or USBH_FAIL
+  * @retval None
+  */
+__weak void USBH_MSC_TransferCpltCallback(USBH_HandleTypeDef *phost, uint8_t lun,
+                                          USBH_StatusTypeDef status)
+{
+  /* Prevent unused argument(s) compilation warning */
+  UNUSED(phost);
+  UNUSED(lun);
+  UNUSED(status);
+
+  /* NOTE : This function should not be modified, when the callback is needed,
+            the USBH_MSC_TransferCpltCallback could be implemented in the user file
+   */
 }
 
 /**
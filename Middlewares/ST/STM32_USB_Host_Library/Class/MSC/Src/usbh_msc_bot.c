@@ -56,6 +56,8 @@ EndBSPDependencies */
 /** @defgroup USBH_MSC_BOT_Private_Defines
   * @{
   */
+/* Largest data stage URB: the length of the USBH I/O requests is 16-bit */
+#define BOT_DATA_URB_MAX_LENGTH                  0xFFFFU
 /**
   * @}
   */
@@ -82,6 +84,7 @@ EndBSPDependencies */
   */
 static USBH_StatusTypeDef USBH_MSC_BOT_Abort(USBH_HandleTypeDef *phost, uint8_t lun, uint8_t dir);
 static BOT_CSWStatusTypeDef USBH_MSC_DecodeCSW(USBH_HandleTypeDef *phost);
+static uint16_t USBH_MSC_BOT_DataUrbLength(uint32_t length, uint16_t mps);
 /**
   * @}
   */
@@ -177,6 +180,7 @@ USBH_StatusTypeDef USBH_MSC_BOT_Process(USBH_HandleTypeDef *phost, uint8_t lun)
   USBH_URBStateTypeDef URB_Status = USBH_URB_IDLE;
   MSC_HandleTypeDef *MSC_Handle = (MSC_HandleTypeDef *) phost->pActiveClass->pData;
   uint8_t toggle = 0U;
+  uint16_t xfer_length;
 
   switch (MSC_Handle->hbot.state)
   {
@@ -257,9 +261,12 @@ USBH_StatusTypeDef USBH_MSC_BOT_Process(USBH_HandleTypeDef *phost, uint8_t lun)
       break;
 
     case BOT_DATA_IN:
-      /* Send first packet */
+      /* Receive the whole data stage in one multi-packet transfer, the
+         channel is re-armed for each packet by the HCD */
       (void)USBH_BulkReceiveData(phost, MSC_Handle->hbot.pbuf,
-                                 MSC_Handle->InEpSize, MSC_Handle->InPipe);
+                                 USBH_MSC_BOT_DataUrbLength(MSC_Handle->hbot.cbw.field.DataTransferLength,
+                                                            MSC_Handle->InEpSize),
+                                 MSC_Handle->InPipe);
 
       MSC_Handle->hbot.state = BOT_DATA_IN_WAIT;
 
@@ -271,23 +278,31 @@ USBH_StatusTypeDef USBH_MSC_BOT_Process(USBH_HandleTypeDef *phost, uint8_t lun)
 
       if (URB_Status == USBH_URB_DONE)
       {
-        /* Adjust Data pointer and data length */
-        if (MSC_Handle->hbot.cbw.field.DataTransferLength > MSC_Handle->InEpSize)
+        /* Adjust Data pointer and data length: a short packet ends the
+           data stage before the requested length. The pointer only moves
+           when more data follows, the SCSI layer parses the response from
+           the pointer it set */
+        xfer_length = USBH_MSC_BOT_DataUrbLength(MSC_Handle->hbot.cbw.field.DataTransferLength,
+                                                 MSC_Handle->InEpSize);
+        if ((USBH_LL_GetLastXferSize(phost, MSC_Handle->InPipe) < xfer_length) ||
+            (MSC_Handle->hbot.cbw.field.DataTransferLength <= xfer_length))
         {
-          MSC_Handle->hbot.pbuf += MSC_Handle->InEpSize;
-          MSC_Handle->hbot.cbw.field.DataTransferLength -= MSC_Handle->InEpSize;
+          MSC_Handle->hbot.cbw.field.DataTransferLength = 0U;
         }
         else
         {
-          MSC_Handle->hbot.cbw.field.DataTransferLength = 0U;
+          MSC_Handle->hbot.pbuf += xfer_length;
+          MSC_Handle->hbot.cbw.field.DataTransferLength -= xfer_length;
         }
 
         /* More Data To be Received */
         if (MSC_Handle->hbot.cbw.field.DataTransferLength > 0U)
         {
-          /* Send next packet */
+          /* Receive the next part of the data stage */
           (void)USBH_BulkReceiveData(phost, MSC_Handle->hbot.pbuf,
-                                     MSC_Handle->InEpSize, MSC_Handle->InPipe);
+                                     USBH_MSC_BOT_DataUrbLength(MSC_Handle->hbot.cbw.field.DataTransferLength,
+                                                                MSC_Handle->InEpSize),
+                                     MSC_Handle->InPipe);
         }
         else
         {
@@ -332,8 +347,12 @@ USBH_StatusTypeDef USBH_MSC_BOT_Process(USBH_HandleTypeDef *phost, uint8_t lun)
 
     case BOT_DATA_OUT:
 
+      /* Send the whole data stage in one multi-packet transfer, the HCD
+         refills the Tx FIFO as it empties */
       (void)USBH_BulkSendData(phost, MSC_Handle->hbot.pbuf,
-                              MSC_Handle->OutEpSize, MSC_Handle->OutPipe, 1U);
+                              USBH_MSC_BOT_DataUrbLength(MSC_Handle->hbot.cbw.field.DataTransferLength,
+                                                         MSC_Handle->OutEpSize),
+                              MSC_Handle->OutPipe, 1U);
 
       MSC_Handle->hbot.state  = BOT_DATA_OUT_WAIT;
       break;
@@ -343,11 +362,14 @@ USBH_StatusTypeDef USBH_MSC_BOT_Process(USBH_HandleTypeDef *phost, uint8_t lun)
 
       if (URB_Status == USBH_URB_DONE)
       {
-        /* Adjust Data pointer and data length */
-        if (MSC_Handle->hbot.cbw.field.DataTransferLength > MSC_Handle->OutEpSize)
+        /* Adjust Data pointer and data length, the pointer only moves
+           when more data follows */
+        xfer_length = USBH_MSC_BOT_DataUrbLength(MSC_Handle->hbot.cbw.field.DataTransferLength,
+                                                 MSC_Handle->OutEpSize);
+        if (MSC_Handle->hbot.cbw.field.DataTransferLength > xfer_length)
         {
-          MSC_Handle->hbot.pbuf += MSC_Handle->OutEpSize;
-          MSC_Handle->hbot.cbw.field.DataTransferLength -= MSC_Handle->OutEpSize;
+          MSC_Handle->hbot.pbuf += xfer_length;
+          MSC_Handle->hbot.cbw.field.DataTransferLength -= xfer_length;
         }
         else
         {
@@ -358,7 +380,9 @@ USBH_StatusTypeDef USBH_MSC_BOT_Process(USBH_HandleTypeDef *phost, uint8_t lun)
         if (MSC_Handle->hbot.cbw.field.DataTransferLength > 0U)
         {
           (void)USBH_BulkSendData(phost, MSC_Handle->hbot.pbuf,
-                                  MSC_Handle->OutEpSize, MSC_Handle->OutPipe, 1U);
+                                  USBH_MSC_BOT_DataUrbLength(MSC_Handle->hbot.cbw.field.DataTransferLength,
+                                                             MSC_Handle->OutEpSize),
+                                  MSC_Handle->OutPipe, 1U);
         }
         else
         {
@@ -558,6 +582,22 @@ static USBH_StatusTypeDef USBH_MSC_BOT_Abort(USBH_HandleTypeDef *phost, uint8_t
   return status;
 }
 
+/**
+  * @brief  USBH_MSC_BOT_DataUrbLength
+  *         Returns the length of the next data stage URB: the rest of the
+  *         data stage, limited to a whole number of packets fitting the
+  *         16-bit URB length.
+  * @param  length: Bytes left in the data stage
+  * @param  mps: Max packet size of the endpoint
+  * @retval URB length
+  */
+static uint16_t USBH_MSC_BOT_DataUrbLength(uint32_t length, uint16_t mps)
+{
+  uint32_t max_length = (BOT_DATA_URB_MAX_LENGTH / mps) * mps;
+
+  return (uint16_t)((length > max_length) ? max_length : length);
+}
+
 /**
   * @brief  USBH_MSC_BOT_DecodeCSW
   *         This function decodes the CSW received by the device and updates the
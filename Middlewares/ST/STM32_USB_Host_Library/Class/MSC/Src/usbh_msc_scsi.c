@@ -318,6 +318,74 @@ USBH_StatusTypeDef USBH_MSC_SCSI_RequestSense(USBH_HandleTypeDef *phost,
   return error;
 }
 
+/**
+  * @brief  USBH_MSC_SCSI_BlockLimits
+  *         Issue INQUIRY command for the Block Limits VPD page
+  * @param  phost: Host handle
+  * @param  lun: Logical Unit Number
+  * @param  limits: pointer to the transfer limits structure
+  * @retval USBH Status
+  */
+USBH_StatusTypeDef USBH_MSC_SCSI_BlockLimits(USBH_HandleTypeDef *phost, uint8_t lun,
+                                             SCSI_BlockLimitsTypeDef *limits)
+{
+  USBH_StatusTypeDef error = USBH_FAIL;
+  MSC_HandleTypeDef *MSC_Handle = (MSC_HandleTypeDef *) phost->pActiveClass->pData;
+  uint8_t *pbuf;
+
+  switch (MSC_Handle->hbot.cmd_state)
+  {
+    case BOT_CMD_SEND:
+
+      /*Prepare the CBW and relevant field*/
+      MSC_Handle->hbot.cbw.field.DataTransferLength = DATA_LEN_BLOCK_LIMITS;
+      MSC_Handle->hbot.cbw.field.Flags = USB_EP_DIR_IN;
+      MSC_Handle->hbot.cbw.field.CBLength = CBW_LENGTH;
+
+      (void)USBH_memset(MSC_Handle->hbot.cbw.field.CB, 0, CBW_LENGTH);
+      MSC_Handle->hbot.cbw.field.CB[0]  = OPCODE_INQUIRY;
+      MSC_Handle->hbot.cbw.field.CB[1]  = (lun << 5) | INQUIRY_EVPD;
+      MSC_Handle->hbot.cbw.field.CB[2]  = VPD_PAGE_BLOCK_LIMITS;
+      MSC_Handle->hbot.cbw.field.CB[3]  = 0U;
+      MSC_Handle->hbot.cbw.field.CB[4]  = DATA_LEN_BLOCK_LIMITS;
+      MSC_Handle->hbot.cbw.field.CB[5]  = 0U;
+
+      MSC_Handle->hbot.state = BOT_SEND_CBW;
+
+      MSC_Handle->hbot.cmd_state = BOT_CMD_WAIT;
+      MSC_Handle->hbot.pbuf = (uint8_t *)(void *)MSC_Handle->hbot.data;
+      error = USBH_BUSY;
+      break;
+
+    case BOT_CMD_WAIT:
+
+      error = USBH_MSC_BOT_Process(phost, lun);
+
+      if (error == USBH_OK)
+      {
+        pbuf = MSC_Handle->hbot.pbuf;
+
+        if (pbuf[1] != VPD_PAGE_BLOCK_LIMITS)
+        {
+          error = USBH_FAIL;
+          break;
+        }
+
+        /* Maximum and optimal transfer lengths, big endian */
+        limits->max_transfer = ((uint32_t)pbuf[8] << 24) | ((uint32_t)pbuf[9] << 16) |
+                               ((uint32_t)pbuf[10] << 8) | (uint32_t)pbuf[11];
+        limits->opt_transfer = ((uint32_t)pbuf[12] << 24) | ((uint32_t)pbuf[13] << 16) |
+                               ((uint32_t)pbuf[14] << 8) | (uint32_t)pbuf[15];
+      }
+      break;
+
+    default:
+      break;
+  }
+
+  return error;
+}
+
 /**
   * @brief  USBH_MSC_SCSI_Write
   *         Issue write10 command.
@@ -343,7 +411,7 @@ USBH_StatusTypeDef USBH_MSC_SCSI_Write(USBH_HandleTypeDef *phost,
     case BOT_CMD_SEND:
 
       /*Prepare the CBW and relevant field*/
-      MSC_Handle->hbot.cbw.field.DataTransferLength = length * MSC_Handle->unit[0].capacity.block_size;
+      MSC_Handle->hbot.cbw.field.DataTransferLength = length * MSC_Handle->unit[lun].capacity.block_size;
       MSC_Handle->hbot.cbw.field.Flags = USB_EP_DIR_OUT;
       MSC_Handle->hbot.cbw.field.CBLength = CBW_LENGTH;
 
@@ -403,7 +471,7 @@ USBH_StatusTypeDef USBH_MSC_SCSI_Read(USBH_HandleTypeDef *phost,
     case BOT_CMD_SEND:
 
       /*Prepare the CBW and relevant field*/
-      MSC_Handle->hbot.cbw.field.DataTransferLength = length * MSC_Handle->unit[0].capacity.block_size;
+      MSC_Handle->hbot.cbw.field.DataTransferLength = length * MSC_Handle->unit[lun].capacity.block_size;
       MSC_Handle->hbot.cbw.field.Flags = USB_EP_DIR_IN;
       MSC_Handle->hbot.cbw.field.CBLength = CBW_LENGTH;
 
@@ -106,6 +106,7 @@ uint8_t              USBH_IsPortEnabled(USBH_HandleTypeDef *phost);
 USBH_StatusTypeDef  USBH_Start(USBH_HandleTypeDef *phost);
 USBH_StatusTypeDef  USBH_Stop(USBH_HandleTypeDef *phost);
 USBH_StatusTypeDef  USBH_Process(USBH_HandleTypeDef *phost);
+void                USBH_StartDelay(USBH_HandleTypeDef *phost, uint32_t Delay);
 USBH_StatusTypeDef  USBH_ReEnumerate(USBH_HandleTypeDef *phost);
 
 /* USBH Low Level Driver */
@@ -118,6 +119,7 @@ USBH_StatusTypeDef   USBH_LL_Connect(USBH_HandleTypeDef *phost);
 USBH_StatusTypeDef   USBH_LL_Disconnect(USBH_HandleTypeDef *phost);
 USBH_SpeedTypeDef    USBH_LL_GetSpeed(USBH_HandleTypeDef *phost);
 USBH_StatusTypeDef   USBH_LL_ResetPort(USBH_HandleTypeDef *phost);
+USBH_StatusTypeDef   USBH_LL_DriverResetPort(USBH_HandleTypeDef *phost, uint8_t state);
 uint32_t             USBH_LL_GetLastXferSize(USBH_HandleTypeDef *phost,
                                              uint8_t pipe);
 
@@ -164,6 +166,7 @@ void USBH_LL_SetTimer(USBH_HandleTypeDef *phost, uint32_t time);
 void USBH_LL_IncTimer(USBH_HandleTypeDef *phost);
 
 void USBH_Delay(uint32_t Delay);
+uint32_t USBH_GetTick(void);
 
 /**
   * @}
@@ -337,6 +337,8 @@ typedef enum
 typedef enum
 {
   HOST_IDLE = 0U,
+  HOST_DEV_DEBOUNCE,
+  HOST_DEV_RESET,
   HOST_DEV_WAIT_FOR_ATTACHMENT,
   HOST_DEV_ATTACHED,
   HOST_DEV_DISCONNECTED,
@@ -475,6 +477,8 @@ typedef struct _USBH_HandleTypeDef
   uint32_t              Pipes[16];
   __IO uint32_t         Timer;
   uint32_t              Timeout;
+  uint32_t              DelayStart;   /* Tick of the USBH_StartDelay call */
+  uint32_t              DelayTime;    /* Delay in ms, 0 when none */
   uint8_t               id;
   void                 *pData;
   void (* pUser)(struct _USBH_HandleTypeDef *pHandle, uint8_t id);
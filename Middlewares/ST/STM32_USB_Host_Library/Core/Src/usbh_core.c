@@ -237,6 +237,7 @@ static USBH_StatusTypeDef DeInitStateMachine(USBH_HandleTypeDef *phost)
   phost->EnumState = ENUM_IDLE;
   phost->RequestState = CMD_SEND;
   phost->Timer = 0U;
+  phost->DelayTime = 0U;
 
   phost->Control.state = CTRL_SETUP;
   phost->Control.pipe_size = USBH_MPS_DEFAULT;
@@ -464,6 +465,22 @@ USBH_StatusTypeDef USBH_ReEnumerate(USBH_HandleTypeDef *phost)
 }
 
 
+/**
+  * @brief  USBH_StartDelay
+  *         Hold the state machine of the USB Core for a while: USBH_Process
+  *         returns at once until the delay has elapsed, the caller keeps
+  *         running in the meantime.
+  * @param  phost: Host Handle
+  * @param  Delay: Delay in ms, 0 for none
+  * @retval None
+  */
+void USBH_StartDelay(USBH_HandleTypeDef *phost, uint32_t Delay)
+{
+  phost->DelayStart = USBH_GetTick();
+  phost->DelayTime = Delay;
+}
+
+
 /**
   * @brief  USBH_Process
   *         Background process of the USB Core.
@@ -475,6 +492,24 @@ USBH_StatusTypeDef  USBH_Process(USBH_HandleTypeDef *phost)
   __IO USBH_StatusTypeDef status = USBH_FAIL;
   uint8_t idx = 0U;
 
+  /* A wait started by USBH_StartDelay holds the state machine */
+  if (phost->DelayTime != 0U)
+  {
+    if ((USBH_GetTick() - phost->DelayStart) < phost->DelayTime)
+    {
+#if (USBH_USE_OS == 1U)
+        phost->os_msg = (uint32_t)USBH_PORT_EVENT;
+#if (osCMSIS < 0x20000U)
+        (void)osMessagePut(phost->os_event, phost->os_msg, 0U);
+#else
+        (void)osMessageQueuePut(phost->os_event, &phost->os_msg, 0U, 0U);
+#endif
+#endif
+      return USBH_OK;
+    }
+    phost->DelayTime = 0U;
+  }
+
   /* check for Host pending port disconnect event */
   if (phost->device.is_disconnected == 1U)
   {
@@ -489,14 +524,9 @@ USBH_StatusTypeDef  USBH_Process(USBH_HandleTypeDef *phost)
       {
         USBH_UsrLog("USB Device Connected");
 
-        /* Wait for 200 ms after connection */
-        phost->gState = HOST_DEV_WAIT_FOR_ATTACHMENT;
-        USBH_Delay(200U);
-        (void)USBH_LL_ResetPort(phost);
-
-        /* Make sure to start with Default address */
-        phost->device.address = USBH_ADDRESS_DEFAULT;
-        phost->Timeout = 0U;
+        /* Debounce the attachment before resetting the port */
+        phost->gState = HOST_DEV_DEBOUNCE;
+        USBH_StartDelay(phost, USBH_ATTACH_DEBOUNCE_TIME);
 
 #if (USBH_USE_OS == 1U)
         phost->os_msg = (uint32_t)USBH_PORT_EVENT;
@@ -509,6 +539,41 @@ USBH_StatusTypeDef  USBH_Process(USBH_HandleTypeDef *phost)
       }
       break;
 
+    case HOST_DEV_DEBOUNCE: /* Attachment stable: reset the port */
+
+      (void)USBH_LL_DriverResetPort(phost, 1U);
+      phost->gState = HOST_DEV_RESET;
+      USBH_StartDelay(phost, USBH_PORT_RESET_TIME);
+
+#if (USBH_USE_OS == 1U)
+      phost->os_msg = (uint32_t)USBH_PORT_EVENT;
+#if (osCMSIS < 0x20000U)
+      (void)osMessagePut(phost->os_event, phost->os_msg, 0U);
+#else
+      (void)osMessageQueuePut(phost->os_event, &phost->os_msg, 0U, 0U);
+#endif
+#endif
+      break;
+
+    case HOST_DEV_RESET: /* Reset time elapsed: release the port reset */
+
+      (void)USBH_LL_DriverResetPort(phost, 0U);
+
+      /* Make sure to start with Default address */
+      phost->device.address = USBH_ADDRESS_DEFAULT;
+      phost->Timeout = USBH_GetTick();
+      phost->gState = HOST_DEV_WAIT_FOR_ATTACHMENT;
+
+#if (USBH_USE_OS == 1U)
+      phost->os_msg = (uint32_t)USBH_PORT_EVENT;
+#if (osCMSIS < 0x20000U)
+      (void)osMessagePut(phost->os_event, phost->os_msg, 0U);
+#else
+      (void)osMessageQueuePut(phost->os_event, &phost->os_msg, 0U, 0U);
+#endif
+#endif
+      break;
+
     case HOST_DEV_WAIT_FOR_ATTACHMENT: /* Wait for Port Enabled */
 
       if (phost->device.PortEnabled == 1U)
@@ -516,10 +581,13 @@ USBH_StatusTypeDef  USBH_Process(USBH_HandleTypeDef *phost)
         USBH_UsrLog("USB Device Reset Completed");
         phost->device.RstCnt = 0U;
         phost->gState = HOST_DEV_ATTACHED;
+
+        /* Reset recovery starts with the port enable */
+        USBH_StartDelay(phost, USBH_RESET_RECOVERY_TIME);
       }
       else
       {
-        if (phost->Timeout > USBH_DEV_RESET_TIMEOUT)
+        if ((USBH_GetTick() - phost->Timeout) > USBH_DEV_RESET_TIMEOUT)
         {
           phost->device.RstCnt++;
           if (phost->device.RstCnt > 3U)
@@ -533,11 +601,6 @@ USBH_StatusTypeDef  USBH_Process(USBH_HandleTypeDef *phost)
             phost->gState = HOST_IDLE;
           }
         }
-        else
-        {
-          phost->Timeout += 10U;
-          USBH_Delay(10U);
-        }
       }
 #if (USBH_USE_OS == 1U)
       phost->os_msg = (uint32_t)USBH_PORT_EVENT;
@@ -556,9 +619,6 @@ USBH_StatusTypeDef  USBH_Process(USBH_HandleTypeDef *phost)
         phost->pUser(phost, HOST_USER_CONNECTION);
       }
 
-      /* Wait for 100 ms after Reset */
-      USBH_Delay(100U);
-
       phost->device.speed = (uint8_t)USBH_LL_GetSpeed(phost);
 
       phost->gState = HOST_ENUMERATION;
@@ -788,6 +848,9 @@ USBH_StatusTypeDef  USBH_Process(USBH_HandleTypeDef *phost)
     case HOST_DEV_DISCONNECTED :
       phost->device.is_disconnected = 0U;
 
+      /* The device may have left while the port reset was driven */
+      (void)USBH_LL_DriverResetPort(phost, 0U);
+
       (void)DeInitStateMachine(phost);
 
       /* Re-Initilaize Host for new Enumeration */
@@ -934,7 +997,8 @@ static USBH_StatusTypeDef USBH_HandleEnum(USBH_HandleTypeDef *phost)
       ReqStatus = USBH_SetAddress(phost, USBH_DEVICE_ADDRESS);
       if (ReqStatus == USBH_OK)
       {
-        USBH_Delay(2U);
+        /* SET_ADDRESS recovery (TDSETADDR), before the next request */
+        USBH_StartDelay(phost, 2U);
         phost->device.address = USBH_DEVICE_ADDRESS;
 
         /* user callback for device address assigned */
@@ -0,0 +1,41 @@
+#!/usr/bin/env python3
+"""Prefixes a plain application image with the header read by the bootloader.
+
+The header is four little-endian words: magic "IMGH", version, image size
+and CRC of the image (STM32 CRC unit, see compress_image.py), padded with
+0xFF to a whole 512-byte disk sector so that the image starts on a sector
+boundary and is read with raw multi-sector reads. It is not programmed. When the size and CRC match the record of the installed image,
+the bootloader skips the update.
+
+usage: add_image_header.py app.bin TM_IMAGE.BIN --version 0x00010200
+"""
+
+import argparse
+import struct
+
+from compress_image import stm32_crc
+
+MAGIC = 0x48474D49  # "IMGH"
+# The header takes a whole disk sector
+HEADER_SIZE = 512
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("input", help="plain application image")
+    parser.add_argument("output", help="image with header to copy to the stick")
+    parser.add_argument("--version", type=lambda x: int(x, 0), default=0,
+                        help="32-bit application version")
+    args = parser.parse_args()
+
+    with open(args.input, "rb") as f:
+        image = f.read()
+
+    with open(args.output, "wb") as f:
+        header = struct.pack("<4I", MAGIC, args.version, len(image), stm32_crc(image))
+        f.write(header + b"\xff" * (HEADER_SIZE - len(header)))
+        f.write(image)
+
+
+if __name__ == "__main__":
+    main()
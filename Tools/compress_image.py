@@ -0,0 +1,143 @@
+#!/usr/bin/env python3
+"""Builds the compressed TM_IMAGE.BIN accepted by the bootloader.
+
+The output is a 16-byte header (magic "LZ4I", image size, image CRC, block
+size) followed by blocks. Each block starts with a 32-bit word giving the
+size of its data; bit 31 is set when the data is stored as is because LZ4
+did not make it smaller. Blocks are independent LZ4 blocks of block size
+bytes once decoded, the last one holds the rest of the image. All words are
+little-endian.
+
+The CRC is the one of the STM32 CRC unit (see crc_if.c): CRC-32 polynomial
+0x04C11DB7, initial value 0xFFFFFFFF, no reflection, no final XOR, over
+little-endian 32-bit words, the last partial word padded with 0xFF.
+
+usage: compress_image.py app.bin TM_IMAGE.BIN [--block-size 16384]
+"""
+
+import argparse
+import struct
+import sys
+
+MAGIC = 0x49345A4C  # "LZ4I"
+BLOCK_STORED = 0x80000000
+MAX_BLOCK_SIZE = 16384
+MIN_MATCH = 4
+# LZ4 end of block rules: the last match starts 12 bytes before the end at
+# the latest and the last 5 bytes are literals
+MF_LIMIT = 12
+LAST_LITERALS = 5
+MAX_OFFSET = 65535
+# Match candidates compared at each position
+SEARCH_DEPTH = 16
+
+
+def stm32_crc(data):
+    if len(data) % 4:
+        data = data + b"\xff" * (4 - len(data) % 4)
+    crc = 0xFFFFFFFF
+    for (word,) in struct.iter_unpack("<I", data):
+        crc ^= word
+        for _ in range(32):
+            if crc & 0x80000000:
+                crc = ((crc << 1) ^ 0x04C11DB7) & 0xFFFFFFFF
+            else:
+                crc = (crc << 1) & 0xFFFFFFFF
+    return crc
+
+
+def write_length(out, length):
+    while length >= 255:
+        out.append(255)
+        length -= 255
+    out.append(length)
+
+
+def write_sequence(out, literals, match_length, offset):
+    lit = len(literals)
+    token = min(lit, 15) << 4
+    if match_length:
+        token |= min(match_length - MIN_MATCH, 15)
+    out.append(token)
+    if lit >= 15:
+        write_length(out, lit - 15)
+    out += literals
+    if match_length:
+        out += struct.pack("<H", offset)
+        if match_length - MIN_MATCH >= 15:
+            write_length(out, match_length - MIN_MATCH - 15)
+
+
+def lz4_compress_block(src):
+    """LZ4 block compression keeping the longest of the last SEARCH_DEPTH
+    candidates with the same leading 4 bytes."""
+    out = bytearray()
+    table = {}
+    anchor = 0
+    pos = 0
+    limit = len(src) - MF_LIMIT
+    end = len(src) - LAST_LITERALS
+    while pos < limit:
+        key = src[pos:pos + MIN_MATCH]
+        chain = table.setdefault(key, [])
+        best_length = 0
+        best_ref = 0
+        for ref in reversed(chain):
+            if pos - ref > MAX_OFFSET:
+                break
+            length = MIN_MATCH
+            while pos + length < end and src[ref + length] == src[pos + length]:
+                length += 1
+            if length > best_length:
+                best_length, best_ref = length, ref
+        chain.append(pos)
+        if len(chain) > SEARCH_DEPTH:
+            del chain[0]
+        if best_length == 0:
+            pos += 1
+            continue
+        write_sequence(out, src[anchor:pos], best_length, pos - best_ref)
+        for skipped in range(pos + 1, min(pos + best_length, limit)):
+            chain = table.setdefault(src[skipped:skipped + MIN_MATCH], [])
+            chain.append(skipped)
+            if len(chain) > SEARCH_DEPTH:
+                del chain[0]
+        pos += best_length
+        anchor = pos
+    write_sequence(out, src[anchor:], 0, 0)
+    return bytes(out)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("input", help="plain application image")
+    parser.add_argument("output", help="compressed image to copy to the stick")
+    parser.add_argument("--block-size", type=int, default=MAX_BLOCK_SIZE,
+                        help="decoded block size, power of 2 from 512 to %d" % MAX_BLOCK_SIZE)
+    args = parser.parse_args()
+
+    bs = args.block_size
+    if bs < 512 or bs > MAX_BLOCK_SIZE or bs & (bs - 1):
+        sys.exit("block size must be a power of 2 from 512 to %d" % MAX_BLOCK_SIZE)
+
+    with open(args.input, "rb") as f:
+        image = f.read()
+
+    out = bytearray(struct.pack("<4I", MAGIC, len(image), stm32_crc(image), bs))
+    for start in range(0, len(image), bs):
+        block = image[start:start + bs]
+        packed = lz4_compress_block(block)
+        if len(packed) < len(block):
+            out += struct.pack("<I", len(packed)) + packed
+        else:
+            out += struct.pack("<I", len(block) | BLOCK_STORED) + block
+
+    with open(args.output, "wb") as f:
+        f.write(out)
+
+    print("%s: %d -> %d bytes (%.2f:1)" % (args.output, len(image), len(out),
+                                           len(image) / max(len(out), 1)))
+
+
+if __name__ == "__main__":
+    main()
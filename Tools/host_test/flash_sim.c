@@ -0,0 +1,168 @@
+/**
+  ******************************************************************************
+  * @file    flash_sim.c
+  * @brief   Model of the internal flash for the host tests.
+  *          Sectors have the sizes of the STM32F407 bank 1. Programming
+  *          follows FLASH_If_WriteBuffer: the length is rounded up to whole
+  *          program units, which must be aligned and erased. Any other
+  *          write is reported as a program error, so a test fails on a
+  *          sink that would have failed on the target.
+  ******************************************************************************
+  * @attention
+  *
+  * This software is licensed under terms that can be found in the LICENSE file
+  * in the root directory of this software component.
+  * If no LICENSE file comes with this software, it is provided AS-IS.
+  *
+  ******************************************************************************
+  */
+/* Includes ------------------------------------------------------------------ */
+#include <stdlib.h>
+#include <string.h>
+#include "flash_sim.h"
+
+/* Private variables --------------------------------------------------------- */
+/* Base address of each sector, followed by the end of the bank */
+static const uint32_t FLASH_Sim_SectorAddress[] =
+{
+  0x08000000, 0x08004000, 0x08008000, 0x0800C000, 0x08010000, 0x08020000,
+  0x08040000, 0x08060000, 0x08080000, 0x080A0000, 0x080C0000, 0x080E0000,
+  0x08100000
+};
+static uint8_t FLASH_Sim_Memory[FLASH_SIM_SIZE];
+static uint32_t FLASH_Sim_Erases = 0;
+
+/* Private functions --------------------------------------------------------- */
+
+/**
+  * @brief  Returns the index of the sector holding an address.
+  */
+static int FLASH_Sim_Sector(uint32_t Address)
+{
+  int index;
+
+  for (index = 0; index < 12; index++)
+  {
+    if (Address < FLASH_Sim_SectorAddress[index + 1])
+    {
+      return index;
+    }
+  }
+  abort();
+}
+
+/**
+  * @brief  Erases the whole bank.
+  */
+void FLASH_Sim_Reset(void)
+{
+  memset(FLASH_Sim_Memory, 0xFF, sizeof(FLASH_Sim_Memory));
+  FLASH_Sim_Erases = 0;
+}
+
+/**
+  * @brief  Fills an area with pseudo-random bytes: flash the code under test
+  *         must not depend on.
+  */
+void FLASH_Sim_Scramble(uint32_t Address, uint32_t Length)
+{
+  uint8_t *memory = FLASH_Sim_Map(Address);
+
+  while (Length-- > 0)
+  {
+    *memory++ = (uint8_t)rand();
+  }
+}
+
+/**
+  * @brief  Erases the sector holding an address.
+  * @retval 0: done, 1: address outside the bank
+  */
+uint32_t FLASH_Sim_Erase(uint32_t Address)
+{
+  int sector;
+
+  if ((Address < FLASH_SIM_BASE) || (Address >= FLASH_SIM_BASE + FLASH_SIM_SIZE))
+  {
+    return 1;
+  }
+
+  sector = FLASH_Sim_Sector(Address);
+  memset(FLASH_Sim_Map(FLASH_Sim_SectorAddress[sector]), 0xFF,
+         FLASH_Sim_SectorAddress[sector + 1] - FLASH_Sim_SectorAddress[sector]);
+  FLASH_Sim_Erases++;
+
+  return 0;
+}
+
+/**
+  * @brief  Programs a buffer like FLASH_If_WriteBuffer.
+  * @retval 0: done, 1: unaligned, outside the bank or not erased
+  */
+uint32_t FLASH_Sim_Program(uint32_t Address, const uint8_t *Data, uint32_t Length)
+{
+  uint32_t rounded = (Length + FLASH_SIM_UNIT - 1) & ~(FLASH_SIM_UNIT - 1);
+
+  if (Length == 0)
+  {
+    return 0;
+  }
+
+  if (((Address % FLASH_SIM_UNIT) != 0) || (Address < FLASH_SIM_BASE) ||
+      (Address + rounded > FLASH_SIM_BASE + FLASH_SIM_SIZE) ||
+      (FLASH_Sim_IsErased(Address, rounded) == 0))
+  {
+    return 1;
+  }
+
+  memcpy(FLASH_Sim_Map(Address), Data, rounded);
+
+  return 0;
+}
+
+/**
+  * @brief  Returns the base address of the sector following an address.
+  */
+uint32_t FLASH_Sim_NextSector(uint32_t Address)
+{
+  return FLASH_Sim_SectorAddress[FLASH_Sim_Sector(Address) + 1];
+}
+
+/**
+  * @brief  Returns the host pointer of a flash address.
+  */
+uint8_t *FLASH_Sim_Map(uint32_t Address)
+{
+  if ((Address < FLASH_SIM_BASE) || (Address > FLASH_SIM_BASE + FLASH_SIM_SIZE))
+  {
+    abort();
+  }
+
+  return &FLASH_Sim_Memory[Address - FLASH_SIM_BASE];
+}
+
+/**
+  * @brief  Tells whether an area is erased.
+  */
+uint8_t FLASH_Sim_IsErased(uint32_t Address, uint32_t Length)
+{
+  const uint8_t *memory = FLASH_Sim_Map(Address);
+
+  while (Length-- > 0)
+  {
+    if (*memory++ != 0xFF)
+    {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+/**
+  * @brief  Returns the number of sector erases since the last reset.
+  */
+uint32_t FLASH_Sim_EraseCount(void)
+{
+  return FLASH_Sim_Erases;
+}
@@ -0,0 +1,40 @@
+/**
+  ******************************************************************************
+  * @file    flash_sim.h
+  * @brief   Header file for flash_sim.c
+  ******************************************************************************
+  * @attention
+  *
+  * This software is licensed under terms that can be found in the LICENSE file
+  * in the root directory of this software component.
+  * If no LICENSE file comes with this software, it is provided AS-IS.
+  *
+  ******************************************************************************
+  */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __FLASH_SIM_H
+#define __FLASH_SIM_H
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+
+/* Exported constants --------------------------------------------------------*/
+/* Bank 1 of the STM32F407 and APPLICATION_ADDRESS of flash_if.h */
+#define FLASH_SIM_BASE             ((uint32_t)0x08000000)
+#define FLASH_SIM_SIZE             ((uint32_t)0x00100000)
+#define FLASH_SIM_APPLICATION      ((uint32_t)0x0800C000)
+/* FLASH_IF_PROGRAM_UNIT of the default FLASH_VOLTAGE_RANGE_3 */
+#define FLASH_SIM_UNIT             ((uint32_t)4)
+
+/* Exported functions ------------------------------------------------------- */
+void FLASH_Sim_Reset(void);
+void FLASH_Sim_Scramble(uint32_t Address, uint32_t Length);
+uint32_t FLASH_Sim_Erase(uint32_t Address);
+uint32_t FLASH_Sim_Program(uint32_t Address, const uint8_t *Data, uint32_t Length);
+uint32_t FLASH_Sim_NextSector(uint32_t Address);
+uint8_t *FLASH_Sim_Map(uint32_t Address);
+uint8_t FLASH_Sim_IsErased(uint32_t Address, uint32_t Length);
+uint32_t FLASH_Sim_EraseCount(void);
+
+#endif  /* __FLASH_SIM_H */
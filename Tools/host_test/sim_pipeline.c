@@ -0,0 +1,308 @@
+/**
+  ******************************************************************************
+  * @file    sim_pipeline.c
+  * @brief   Host model of the download pipeline of command.c.
+  *          COMMAND_ProgramRange reads the image in BUFFER_SIZE chunks. While
+  *          one chunk is transferred over USB, the previous one is programmed
+  *          PROGRAM_SLICE_SIZE bytes at a time from the MSC idle callback,
+  *          and what is left is programmed once the transfer is over. The
+  *          sectors of a chunk are erased before the read it overlaps with.
+  *          This program replays that schedule against modeled USB and flash
+  *          latencies and compares it with the serial read-then-program
+  *          loop it replaced.
+  *
+  *          A BOT read is three stages (CBW, data, CSW). Each stage starts
+  *          only once the host polls the end of the previous one, so a slice
+  *          programmed while a stage completes delays the next stage: the
+  *          model charges that latency.
+  *
+  *          usage: sim_pipeline [-r bytes_per_ms] [-c cmd_overhead_us]
+  *                              [-w word_program_us] [-s slice_bytes]
+  *                              [-p poll_us] [image_kbytes...]
+  ******************************************************************************
+  * @attention
+  *
+  * This software is licensed under terms that can be found in the LICENSE file
+  * in the root directory of this software component.
+  * If no LICENSE file comes with this software, it is provided AS-IS.
+  *
+  ******************************************************************************
+  */
+/* Includes ------------------------------------------------------------------ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/* Private define ------------------------------------------------------------ */
+/* Same values as command.c and flash_if.h */
+#define BUFFER_SIZE                ((uint32_t)512 * 64)
+#define PROGRAM_SLICE_SIZE         ((uint32_t)64)
+#define FLASH_IF_PROGRAM_UNIT      ((uint32_t)4)
+#define APPLICATION_ADDRESS        ((uint32_t)0x0800C000)
+
+/* Private typedef ----------------------------------------------------------- */
+typedef struct
+{
+  double usb_bytes_per_us;              /* Bulk IN throughput of the data stage */
+  double cmd_overhead_us;               /* CBW + CSW + device latency of a command */
+  double word_program_us;               /* One program operation */
+  double poll_us;                       /* One pass of the MSC state machine */
+  uint32_t slice;                       /* Bytes programmed per idle poll */
+} SIM_ModelTypeDef;
+
+typedef struct
+{
+  double read_us;                       /* USB time alone */
+  double program_us;                    /* Program time alone */
+  double erase_us;                      /* Erase time alone */
+  double serial_us;                     /* Read, then erase and program */
+  double pipelined_us;                  /* COMMAND_ProgramRange schedule */
+} SIM_ResultTypeDef;
+
+/* Private variables --------------------------------------------------------- */
+/* Sectors 3 to 11 of the STM32F407: base address and typical erase time at
+   x32 parallelism (datasheet tERASE16KB, tERASE64KB, tERASE128KB) */
+static const uint32_t SectorAddress[] =
+{
+  0x0800C000, 0x08010000, 0x08020000, 0x08040000, 0x08060000,
+  0x08080000, 0x080A0000, 0x080C0000, 0x080E0000, 0x08100000
+};
+static const double SectorEraseUs[] =
+{
+  250000.0, 550000.0, 1000000.0, 1000000.0, 1000000.0,
+  1000000.0, 1000000.0, 1000000.0, 1000000.0
+};
+
+/* Private functions --------------------------------------------------------- */
+
+/**
+  * @brief  Returns the time to program a number of bytes.
+  */
+static double SIM_ProgramTime(const SIM_ModelTypeDef *model, uint32_t bytes)
+{
+  return model->word_program_us * ((bytes + FLASH_IF_PROGRAM_UNIT - 1) / FLASH_IF_PROGRAM_UNIT);
+}
+
+/**
+  * @brief  Returns the time to erase the sectors not erased yet below an
+  *         address, and moves the erase cursor past them.
+  */
+static double SIM_EraseUpTo(uint32_t *erase_address, uint32_t end)
+{
+  double time = 0.0;
+  uint32_t index;
+
+  for (index = 0; index < sizeof(SectorEraseUs) / sizeof(SectorEraseUs[0]); index++)
+  {
+    if ((SectorAddress[index] >= *erase_address) && (SectorAddress[index] < end))
+    {
+      time += SectorEraseUs[index];
+      *erase_address = SectorAddress[index + 1];
+    }
+  }
+
+  return time;
+}
+
+/**
+  * @brief  Replays one BOT read while a program job is pending.
+  * @param  now: Time the read is submitted
+  * @param  bytes: Size of the data stage
+  * @param  remain: Bytes of the job, decreased by the slices programmed
+  * @retval Time the host sees the CSW
+  */
+static double SIM_OverlappedRead(const SIM_ModelTypeDef *model, double now, uint32_t bytes,
+                                 uint32_t *remain)
+{
+  double stage[3];
+  double stage_end;
+  uint32_t size;
+  int index = 0;
+
+  stage[0] = model->cmd_overhead_us / 2.0;
+  stage[1] = bytes / model->usb_bytes_per_us;
+  stage[2] = model->cmd_overhead_us / 2.0;
+  stage_end = now + stage[0];
+
+  while (index < 3)
+  {
+    now += model->poll_us;
+    if (now >= stage_end)
+    {
+      /* The host moves the BOT state machine on */
+      index++;
+      if (index < 3)
+      {
+        stage_end = now + stage[index];
+      }
+    }
+    else if (*remain != 0)
+    {
+      size = (*remain < model->slice) ? *remain : model->slice;
+      now += SIM_ProgramTime(model, size);
+      *remain -= size;
+    }
+    else
+    {
+      /* Nothing left to program: the host spins until the stage ends */
+      now = stage_end;
+    }
+  }
+
+  return now;
+}
+
+/**
+  * @brief  Runs both schedules for one image size.
+  */
+static void SIM_Run(const SIM_ModelTypeDef *model, uint32_t image_size, SIM_ResultTypeDef *result)
+{
+  uint32_t erase_address = APPLICATION_ADDRESS;
+  uint32_t address = APPLICATION_ADDRESS;
+  uint32_t total = 0;
+  uint32_t chunk;
+  uint32_t next;
+  uint32_t remain;
+  double read;
+  double now;
+
+  /* Serial: read a chunk, erase what it covers, program it */
+  result->read_us = 0.0;
+  result->program_us = 0.0;
+  result->erase_us = 0.0;
+  while (total < image_size)
+  {
+    chunk = (image_size - total < BUFFER_SIZE) ? image_size - total : BUFFER_SIZE;
+    read = model->cmd_overhead_us + chunk / model->usb_bytes_per_us;
+    result->read_us += read;
+    result->program_us += SIM_ProgramTime(model, chunk);
+    result->erase_us += SIM_EraseUpTo(&erase_address, address + chunk);
+    address += chunk;
+    total += chunk;
+  }
+  result->serial_us = result->read_us + result->erase_us + result->program_us;
+
+  /* Pipelined: the schedule of COMMAND_ProgramRange */
+  erase_address = APPLICATION_ADDRESS;
+  address = APPLICATION_ADDRESS;
+  chunk = (image_size < BUFFER_SIZE) ? image_size : BUFFER_SIZE;
+  now = model->cmd_overhead_us + chunk / model->usb_bytes_per_us;
+  total = chunk;
+  while (chunk != 0)
+  {
+    /* Hand the chunk over and erase its sectors, no transfer in flight */
+    remain = chunk;
+    now += SIM_EraseUpTo(&erase_address, address + chunk);
+    address += chunk;
+
+    next = (image_size - total < BUFFER_SIZE) ? image_size - total : BUFFER_SIZE;
+    if (next != 0)
+    {
+      now = SIM_OverlappedRead(model, now, next, &remain);
+      total += next;
+    }
+
+    /* What the transfer left over */
+    now += SIM_ProgramTime(model, remain);
+    chunk = next;
+  }
+  result->pipelined_us = now;
+}
+
+/**
+  * @brief  Prints the results of both schedules for one image size.
+  */
+static void SIM_Print(const SIM_ModelTypeDef *model, uint32_t kbytes)
+{
+  SIM_ResultTypeDef result;
+  double ideal;
+
+  SIM_Run(model, kbytes * 1024, &result);
+
+  /* Erase is serial in both schedules: the bound is max(read, program) */
+  ideal = result.erase_us + ((result.read_us > result.program_us) ? result.read_us : result.program_us);
+  printf("%8u %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f %6.2fx\n", kbytes,
+         result.read_us / 1000.0, result.program_us / 1000.0, result.erase_us / 1000.0,
+         result.serial_us / 1000.0, result.pipelined_us / 1000.0, ideal / 1000.0,
+         result.serial_us / result.pipelined_us);
+}
+
+/**
+  * @brief  Parses the options and prints the model results.
+  */
+int main(int argc, char *argv[])
+{
+  static const uint32_t default_sizes[] = { 80, 300, 900 };
+  SIM_ModelTypeDef model;
+  uint32_t size;
+  int opt;
+  int index;
+
+  /* USB full speed MSC: about 1 MB/s on the bulk pipe, 1 ms of command
+   * overhead; x32 word program 16 us typical; 5 us per state machine pass */
+  model.usb_bytes_per_us = 1.0;
+  model.cmd_overhead_us = 1000.0;
+  model.word_program_us = 16.0;
+  model.poll_us = 5.0;
+  model.slice = PROGRAM_SLICE_SIZE;
+
+  while ((opt = getopt(argc, argv, "r:c:w:s:p:")) != -1)
+  {
+    switch (opt)
+    {
+      case 'r':
+        model.usb_bytes_per_us = atof(optarg) / 1000.0;
+        break;
+      case 'c':
+        model.cmd_overhead_us = atof(optarg);
+        break;
+      case 'w':
+        model.word_program_us = atof(optarg);
+        break;
+      case 's':
+        model.slice = (uint32_t)strtoul(optarg, NULL, 0);
+        break;
+      case 'p':
+        model.poll_us = atof(optarg);
+        break;
+      default:
+        fprintf(stderr, "usage: %s [-r bytes_per_ms] [-c cmd_overhead_us] [-w word_program_us]"
+                " [-s slice_bytes] [-p poll_us] [image_kbytes...]\n", argv[0]);
+        return 2;
+    }
+  }
+
+  if ((model.usb_bytes_per_us <= 0.0) || (model.slice == 0) || (model.slice % FLASH_IF_PROGRAM_UNIT != 0))
+  {
+    fprintf(stderr, "bad model parameters\n");
+    return 2;
+  }
+
+  printf("usb %.0f B/ms + %.0f us/cmd, program %.1f us/word, slice %u B, poll %.1f us\n",
+         model.usb_bytes_per_us * 1000.0, model.cmd_overhead_us, model.word_program_us,
+         model.slice, model.poll_us);
+  printf("%8s %9s %9s %9s %9s %9s %9s %7s\n", "KB", "read ms", "prog ms", "erase ms",
+         "serial", "pipeline", "ideal", "speedup");
+
+  if (optind == argc)
+  {
+    for (index = 0; index < (int)(sizeof(default_sizes) / sizeof(default_sizes[0])); index++)
+    {
+      SIM_Print(&model, default_sizes[index]);
+    }
+  }
+
+  for (index = optind; index < argc; index++)
+  {
+    size = (uint32_t)strtoul(argv[index], NULL, 0);
+    if ((size == 0) || (size * 1024 > 0x08100000 - APPLICATION_ADDRESS))
+    {
+      fprintf(stderr, "bad image size %s\n", argv[index]);
+      return 2;
+    }
+    SIM_Print(&model, size);
+  }
+
+  return 0;
+}
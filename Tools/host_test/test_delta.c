@@ -0,0 +1,293 @@
+/**
+  ******************************************************************************
+  * @file    test_delta.c
+  * @brief   Host test of DELTA_If_Apply (Core/Src/delta_if.c).
+  *          Each delta written by make_delta.py is applied to its installed
+  *          image in a model of the flash, through the sink the bootloader
+  *          uses, and the result is compared with the new image, byte for
+  *          byte and through the CRC computed on the way. The flash outside
+  *          the installed image holds random bytes. Each delta is applied
+  *          with the RAM window of the bootloader, then with a small window
+  *          and the x64 program unit, then truncated and with a corrupt
+  *          record, which must be rejected.
+  *
+  *          usage: test_delta [--dual-slot] [installed new delta]...
+  ******************************************************************************
+  * @attention
+  *
+  * This software is licensed under terms that can be found in the LICENSE file
+  * in the root directory of this software component.
+  * If no LICENSE file comes with this software, it is provided AS-IS.
+  *
+  ******************************************************************************
+  */
+/* Includes ------------------------------------------------------------------ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "delta_if.h"
+#include "flash_sim.h"
+
+/* Private define ------------------------------------------------------------ */
+/* Same values as command.c and flash_if.h */
+#define WINDOW_SIZE                ((uint32_t)2 * 512 * 64)
+#define SPARE_ADDRESS              ((uint32_t)0x080E0000)
+#define SLOT_A_ADDRESS             ((uint32_t)0x08020000)
+#define SLOT_B_ADDRESS             ((uint32_t)0x08080000)
+
+/* Private variables --------------------------------------------------------- */
+static uint32_t Failures = 0;
+/* Body of the delta being applied and read position */
+static const uint8_t *Body;
+static uint32_t BodySize;
+static uint32_t BodyPos;
+/* CRC of the bytes accumulated so far; set once a partial word was fed */
+static uint32_t Crc;
+static uint8_t CrcClosed;
+
+/* Private functions --------------------------------------------------------- */
+
+/**
+  * @brief  Reads a whole file.
+  */
+static uint8_t *TEST_ReadFile(const char *path, uint32_t *size)
+{
+  FILE *file = fopen(path, "rb");
+  uint8_t *data;
+  long length;
+
+  if ((file == NULL) || (fseek(file, 0, SEEK_END) != 0) || ((length = ftell(file)) < 0))
+  {
+    fprintf(stderr, "cannot read %s\n", path);
+    exit(2);
+  }
+  rewind(file);
+  data = malloc((size_t)length + 1);
+  if ((data == NULL) || (fread(data, 1, (size_t)length, file) != (size_t)length))
+  {
+    fprintf(stderr, "cannot read %s\n", path);
+    exit(2);
+  }
+  fclose(file);
+  *size = (uint32_t)length;
+
+  return data;
+}
+
+/**
+  * @brief  Reads a little-endian word.
+  */
+static uint32_t TEST_Word(const uint8_t *data)
+{
+  return data[0] | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+/**
+  * @brief  Sink: reads the next bytes of the body.
+  */
+static uint8_t TEST_Read(void *Buff, uint32_t Size)
+{
+  if (Size > BodySize - BodyPos)
+  {
+    return 0;
+  }
+  memcpy(Buff, &Body[BodyPos], Size);
+  BodyPos += Size;
+
+  return 1;
+}
+
+/**
+  * @brief  Sink: CRC_If_Accumulate in software. Like the CRC unit, only the
+  *         last buffer may end on a partial word, padded with 0xFF.
+  */
+static void TEST_Accumulate(const uint8_t *Data, uint32_t Length)
+{
+  uint32_t index;
+  uint32_t word;
+  int bit;
+
+  if (CrcClosed && (Length != 0))
+  {
+    printf("FAIL data accumulated after a partial word\n");
+    Failures++;
+  }
+
+  for (index = 0; index < Length; index += 4)
+  {
+    word = 0xFFFFFFFF;
+    memcpy(&word, &Data[index], ((Length - index) < 4) ? (Length - index) : 4);
+    Crc ^= word;
+    for (bit = 0; bit < 32; bit++)
+    {
+      Crc = ((Crc & 0x80000000) != 0) ? ((Crc << 1) ^ 0x04C11DB7) : (Crc << 1);
+    }
+  }
+  CrcClosed = ((Length % 4) != 0);
+}
+
+/**
+  * @brief  Sink: flash pointer of an address.
+  */
+static const uint8_t *TEST_Map(uint32_t Address)
+{
+  return FLASH_Sim_Map(Address);
+}
+
+static const DELTA_SinkTypeDef TestSink =
+{
+  TEST_Read,
+  FLASH_Sim_Erase,
+  FLASH_Sim_Program,
+  FLASH_Sim_NextSector,
+  TEST_Map,
+  TEST_Accumulate
+};
+
+/**
+  * @brief  Loads the installed image and applies a delta body to it.
+  * @param  window_size: Size of the RAM window
+  * @param  unit: Program unit
+  * @param  programmed: Receives the number of bytes rebuilt
+  * @retval Result of DELTA_If_Apply
+  */
+static DELTA_StatusTypeDef TEST_Apply(const DELTA_HeaderTypeDef *header, const uint8_t *source,
+                                      const uint8_t *delta, uint32_t delta_size, int dual_slot,
+                                      uint32_t window_size, uint32_t unit, uint32_t *programmed)
+{
+  DELTA_HandleTypeDef hdelta;
+  DELTA_StatusTypeDef status;
+  uint8_t *window = malloc(window_size);
+
+  FLASH_Sim_Reset();
+  FLASH_Sim_Scramble(FLASH_SIM_APPLICATION, FLASH_SIM_BASE + FLASH_SIM_SIZE - FLASH_SIM_APPLICATION);
+
+  memset(&hdelta, 0, sizeof(hdelta));
+  hdelta.Sink = &TestSink;
+  hdelta.SourceBase = dual_slot ? SLOT_A_ADDRESS : FLASH_SIM_APPLICATION;
+  hdelta.ImageBase = dual_slot ? SLOT_B_ADDRESS : FLASH_SIM_APPLICATION;
+  hdelta.ImageSize = header->target_size;
+  hdelta.SourceSize = header->source_size;
+  hdelta.Records = header->records;
+  hdelta.SpareAddress = SPARE_ADDRESS;
+  hdelta.Window = window;
+  hdelta.WindowSize = window_size;
+  hdelta.ProgramUnit = unit;
+
+  /* The installed image, programmed over the scrambled flash */
+  memcpy(FLASH_Sim_Map(hdelta.SourceBase), source, header->source_size);
+
+  Body = delta;
+  BodySize = delta_size;
+  BodyPos = DELTA_HEADER_SIZE;
+  Crc = 0xFFFFFFFF;
+  CrcClosed = 0;
+
+  status = DELTA_If_Apply(&hdelta, programmed);
+  free(window);
+
+  return status;
+}
+
+/**
+  * @brief  Applies one delta in every configuration.
+  */
+static void TEST_Delta(const char *source_path, const char *target_path, const char *delta_path,
+                       int dual_slot)
+{
+  static const uint32_t windows[2][2] = { { WINDOW_SIZE, 4 }, { 20 * 1024, 8 } };
+  DELTA_HeaderTypeDef header;
+  uint32_t source_size;
+  uint32_t target_size;
+  uint32_t delta_size;
+  uint8_t *source = TEST_ReadFile(source_path, &source_size);
+  uint8_t *target = TEST_ReadFile(target_path, &target_size);
+  uint8_t *delta = TEST_ReadFile(delta_path, &delta_size);
+  uint32_t image_base = dual_slot ? SLOT_B_ADDRESS : FLASH_SIM_APPLICATION;
+  uint32_t programmed = 0;
+  uint32_t index;
+  uint32_t record;
+  int ok;
+
+  if ((delta_size < DELTA_HEADER_SIZE) || (TEST_Word(delta) != DELTA_MAGIC))
+  {
+    printf("FAIL %s: not a delta file\n", delta_path);
+    Failures++;
+    return;
+  }
+  memcpy(&header, delta, sizeof(header));
+
+  for (index = 0; index < 2; index++)
+  {
+    ok = (header.source_size == source_size) && (header.target_size == target_size) &&
+         (TEST_Apply(&header, source, delta, delta_size, dual_slot, windows[index][0],
+                     windows[index][1], &programmed) == DELTA_OK) &&
+         (BodyPos == delta_size) &&
+         (memcmp(FLASH_Sim_Map(image_base), target, target_size) == 0) &&
+         (Crc == header.target_crc) &&
+         (!dual_slot || (memcmp(FLASH_Sim_Map(SLOT_A_ADDRESS), source, source_size) == 0));
+
+    printf("%s %s: %u records, %u of %u bytes rebuilt, window %u, unit %u\n", ok ? "ok  " : "FAIL",
+           delta_path, header.records, programmed, target_size, windows[index][0], windows[index][1]);
+    if (!ok)
+    {
+      Failures++;
+    }
+  }
+
+  /* The disk goes away in the middle of the body */
+  if ((header.records != 0) &&
+      (TEST_Apply(&header, source, delta, delta_size - 1, dual_slot, WINDOW_SIZE, 4,
+                  &programmed) != DELTA_ERROR_READ))
+  {
+    printf("FAIL %s: truncated body not reported\n", delta_path);
+    Failures++;
+  }
+
+  /* First record off a sector boundary */
+  if (header.records != 0)
+  {
+    record = TEST_Word(&delta[DELTA_HEADER_SIZE]) + 4;
+    memcpy(&delta[DELTA_HEADER_SIZE], &record, sizeof(record));
+    if (TEST_Apply(&header, source, delta, delta_size, dual_slot, WINDOW_SIZE, 4,
+                   &programmed) != DELTA_ERROR_FORMAT)
+    {
+      printf("FAIL %s: corrupt record not reported\n", delta_path);
+      Failures++;
+    }
+  }
+
+  free(delta);
+  free(target);
+  free(source);
+}
+
+/**
+  * @brief  Applies each delta given on the command line.
+  */
+int main(int argc, char *argv[])
+{
+  int dual_slot = 0;
+  int index = 1;
+
+  if ((argc > 1) && (strcmp(argv[1], "--dual-slot") == 0))
+  {
+    dual_slot = 1;
+    index++;
+  }
+
+  if (((argc - index) % 3) != 0)
+  {
+    fprintf(stderr, "usage: %s [--dual-slot] [installed new delta]...\n", argv[0]);
+    return 2;
+  }
+
+  for (; index < argc; index += 3)
+  {
+    TEST_Delta(argv[index], argv[index + 1], argv[index + 2], dual_slot);
+  }
+
+  printf("%u failure(s)\n", Failures);
+  return (Failures == 0) ? 0 : 1;
+}
@@ -0,0 +1,307 @@
+/**
+  ******************************************************************************
+  * @file    test_lz4.c
+  * @brief   Host test of LZ4_If_DecodeBlock (Core/Src/lz4_if.c).
+  *          Hand-made blocks check overlap copies, length extensions, the
+  *          literal-only last sequence and the rejection of corrupt blocks.
+  *          Then each reference frame written by the lz4 tool is decoded
+  *          block by block and programmed into a model of the flash, the
+  *          way COMMAND_ProgramRange does, and the flash is compared with
+  *          the original file.
+  *
+  *          usage: test_lz4 [original frame.lz4]...
+  ******************************************************************************
+  * @attention
+  *
+  * This software is licensed under terms that can be found in the LICENSE file
+  * in the root directory of this software component.
+  * If no LICENSE file comes with this software, it is provided AS-IS.
+  *
+  ******************************************************************************
+  */
+/* Includes ------------------------------------------------------------------ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lz4_if.h"
+#include "flash_sim.h"
+
+/* Private define ------------------------------------------------------------ */
+#define LZ4_FRAME_MAGIC            ((uint32_t)0x184D2204)
+#define LZ4_BLOCK_STORED           ((uint32_t)0x80000000)
+/* FLG bits */
+#define LZ4_FLG_INDEPENDENT        0x20U
+#define LZ4_FLG_BLOCK_CRC          0x10U
+#define LZ4_FLG_CONTENT_SIZE       0x08U
+#define LZ4_FLG_CONTENT_CRC        0x04U
+#define LZ4_FLG_DICT_ID            0x01U
+
+/* Private variables --------------------------------------------------------- */
+static uint32_t Failures = 0;
+
+/* Private functions --------------------------------------------------------- */
+
+/**
+  * @brief  Reports a failed check.
+  */
+static void TEST_Check(int condition, const char *name)
+{
+  if (!condition)
+  {
+    printf("FAIL %s\n", name);
+    Failures++;
+  }
+}
+
+/**
+  * @brief  Decodes a hand-made block and compares it with the expected data.
+  */
+static void TEST_Block(const char *name, const uint8_t *block, uint32_t length,
+                       const uint8_t *expected, uint32_t expected_length)
+{
+  uint8_t out[1024];
+  uint32_t decoded;
+
+  memset(out, 0xA5, sizeof(out));
+  decoded = LZ4_If_DecodeBlock(block, length, out, expected_length);
+  TEST_Check((decoded == expected_length) && (memcmp(out, expected, expected_length) == 0), name);
+  /* Nothing written past the destination */
+  TEST_Check(out[expected_length] == 0xA5, name);
+}
+
+/**
+  * @brief  Checks that a corrupt block is reported.
+  */
+static void TEST_Corrupt(const char *name, const uint8_t *block, uint32_t length, uint32_t dst_length)
+{
+  uint8_t out[1024];
+
+  memset(out, 0xA5, sizeof(out));
+  TEST_Check(LZ4_If_DecodeBlock(block, length, out, dst_length) == 0, name);
+  TEST_Check(out[dst_length] == 0xA5, name);
+}
+
+/**
+  * @brief  Hand-made blocks.
+  */
+static void TEST_Vectors(void)
+{
+  /* Literals only: the whole block is its last sequence */
+  static const uint8_t literal_only[] = { 0x50, 'h', 'e', 'l', 'l', 'o' };
+  /* "ab" then a match of 10 at offset 2: overlapping copy */
+  static const uint8_t overlap2[] = { 0x26, 'a', 'b', 0x02, 0x00, 0x00 };
+  /* "x" then a match of 4 + 15 + 255 + 10 at offset 1: run length */
+  static const uint8_t overlap1[] = { 0x1F, 'x', 0x01, 0x00, 0xFF, 0x0A, 0x00 };
+  /* 15 + 5 literals through a length extension, then the last sequence */
+  static const uint8_t long_literals[] =
+  {
+    0xF0, 0x05, 'a', 'b', 'c', 'd', 'e', 'f', 'g', 'h', 'i', 'j',
+    'k', 'l', 'm', 'n', 'o', 'p', 'q', 'r', 's', 't'
+  };
+  /* "abcd" then a match of 4 at offset 4, then 2 last literals */
+  static const uint8_t two_sequences[] =
+  {
+    0x40, 'a', 'b', 'c', 'd', 0x04, 0x00, 0x20, 'y', 'z'
+  };
+  /* Match offset 0, offset past the output, truncated offset, truncated
+   * length extension, literals past the input */
+  static const uint8_t offset_zero[] = { 0x10, 'a', 0x00, 0x00, 0x00 };
+  static const uint8_t offset_far[] = { 0x10, 'a', 0x02, 0x00, 0x00 };
+  static const uint8_t offset_cut[] = { 0x10, 'a', 0x01 };
+  static const uint8_t length_cut[] = { 0xF0, 0xFF };
+  static const uint8_t literal_cut[] = { 0x50, 'a', 'b' };
+  uint8_t expected[512];
+  uint32_t index;
+
+  TEST_Block("literal only", literal_only, sizeof(literal_only), (const uint8_t *)"hello", 5);
+
+  memcpy(expected, "abababababab", 12);
+  TEST_Block("overlap offset 2", overlap2, sizeof(overlap2), expected, 12);
+
+  memset(expected, 'x', 1 + 4 + 15 + 255 + 10);
+  TEST_Block("overlap offset 1", overlap1, sizeof(overlap1), expected, 1 + 4 + 15 + 255 + 10);
+
+  TEST_Block("literal extension", long_literals, sizeof(long_literals),
+             (const uint8_t *)"abcdefghijklmnopqrst", 20);
+
+  TEST_Block("two sequences", two_sequences, sizeof(two_sequences),
+             (const uint8_t *)"abcdabcdyz", 10);
+
+  TEST_Corrupt("offset zero", offset_zero, sizeof(offset_zero), 64);
+  TEST_Corrupt("offset past output", offset_far, sizeof(offset_far), 64);
+  TEST_Corrupt("truncated offset", offset_cut, sizeof(offset_cut), 64);
+  TEST_Corrupt("truncated length", length_cut, sizeof(length_cut), 64);
+  TEST_Corrupt("truncated literals", literal_cut, sizeof(literal_cut), 64);
+
+  /* Destination too small, for literals and for a match */
+  TEST_Corrupt("literals past destination", literal_only, sizeof(literal_only), 4);
+  TEST_Corrupt("match past destination", overlap2, sizeof(overlap2), 11);
+
+  /* Every truncation of a valid block decodes short or is rejected */
+  for (index = 1; index < sizeof(two_sequences); index++)
+  {
+    uint8_t out[16];
+    uint32_t decoded = LZ4_If_DecodeBlock(two_sequences, index, out, sizeof(out));
+
+    TEST_Check((decoded < 10) && ((decoded == 0) || (memcmp(out, "abcdabcdyz", decoded) == 0)),
+               "truncated block");
+  }
+}
+
+/**
+  * @brief  Reads a whole file.
+  */
+static uint8_t *TEST_ReadFile(const char *path, uint32_t *size)
+{
+  FILE *file = fopen(path, "rb");
+  uint8_t *data;
+  long length;
+
+  if ((file == NULL) || (fseek(file, 0, SEEK_END) != 0) || ((length = ftell(file)) < 0))
+  {
+    fprintf(stderr, "cannot read %s\n", path);
+    exit(2);
+  }
+  rewind(file);
+  data = malloc((size_t)length + 1);
+  if ((data == NULL) || (fread(data, 1, (size_t)length, file) != (size_t)length))
+  {
+    fprintf(stderr, "cannot read %s\n", path);
+    exit(2);
+  }
+  fclose(file);
+  *size = (uint32_t)length;
+
+  return data;
+}
+
+/**
+  * @brief  Reads a little-endian word.
+  */
+static uint32_t TEST_Word(const uint8_t *data)
+{
+  return data[0] | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+/**
+  * @brief  Decodes an LZ4 frame into the flash model and compares the
+  *         result with the original file.
+  */
+static void TEST_Frame(const char *original_path, const char *frame_path)
+{
+  uint32_t original_size;
+  uint32_t frame_size;
+  uint8_t *original = TEST_ReadFile(original_path, &original_size);
+  uint8_t *frame = TEST_ReadFile(frame_path, &frame_size);
+  uint8_t *block;
+  uint32_t block_max;
+  uint32_t pos;
+  uint32_t word;
+  uint32_t length;
+  uint32_t decoded;
+  uint32_t address = FLASH_SIM_APPLICATION;
+  uint32_t blocks = 0;
+  uint8_t flg;
+  int ok = 1;
+
+  if ((frame_size < 7) || (TEST_Word(frame) != LZ4_FRAME_MAGIC))
+  {
+    printf("FAIL %s: not an LZ4 frame\n", frame_path);
+    Failures++;
+    return;
+  }
+
+  flg = frame[4];
+  block_max = (uint32_t)1 << (8 + 2 * ((frame[5] >> 4) & 0x07));
+  if ((flg & LZ4_FLG_INDEPENDENT) == 0)
+  {
+    printf("FAIL %s: linked blocks, the bootloader decodes independent blocks\n", frame_path);
+    Failures++;
+    return;
+  }
+  pos = 6 + (((flg & LZ4_FLG_CONTENT_SIZE) != 0) ? 8 : 0) + (((flg & LZ4_FLG_DICT_ID) != 0) ? 4 : 0) + 1;
+
+  /* Program buffer of the largest block, padded like RAM_Buf */
+  block = malloc(block_max + FLASH_SIM_UNIT);
+  FLASH_Sim_Reset();
+
+  while (ok && (pos + 4 <= frame_size))
+  {
+    word = TEST_Word(&frame[pos]);
+    pos += 4;
+    if (word == 0)
+    {
+      break;
+    }
+
+    length = word & ~LZ4_BLOCK_STORED;
+    if ((length > frame_size - pos) || (length > block_max))
+    {
+      ok = 0;
+      break;
+    }
+
+    if ((word & LZ4_BLOCK_STORED) != 0)
+    {
+      memcpy(block, &frame[pos], length);
+      decoded = length;
+    }
+    else
+    {
+      decoded = LZ4_If_DecodeBlock(&frame[pos], length, block, block_max);
+      ok = (decoded != 0);
+    }
+    pos += length + (((flg & LZ4_FLG_BLOCK_CRC) != 0) ? 4 : 0);
+
+    /* Sink: the flash programmer of COMMAND_ProgramRange */
+    if (ok)
+    {
+      memset(&block[decoded], 0xFF, FLASH_SIM_UNIT);
+      ok = (FLASH_Sim_Program(address, block, decoded) == 0);
+      address += decoded;
+      blocks++;
+    }
+  }
+
+  ok = ok && (address - FLASH_SIM_APPLICATION == original_size) &&
+       (memcmp(FLASH_Sim_Map(FLASH_SIM_APPLICATION), original, original_size) == 0) &&
+       (FLASH_Sim_IsErased(address, FLASH_SIM_BASE + FLASH_SIM_SIZE - address) != 0);
+
+  printf("%s %s: %u bytes, %u blocks of up to %u bytes\n", ok ? "ok  " : "FAIL", frame_path,
+         original_size, blocks, block_max);
+  if (!ok)
+  {
+    Failures++;
+  }
+
+  free(block);
+  free(frame);
+  free(original);
+}
+
+/**
+  * @brief  Runs the hand-made blocks, then each frame given on the command
+  *         line.
+  */
+int main(int argc, char *argv[])
+{
+  int index;
+
+  if ((argc % 2) != 1)
+  {
+    fprintf(stderr, "usage: %s [original frame.lz4]...\n", argv[0]);
+    return 2;
+  }
+
+  TEST_Vectors();
+  printf("%s hand-made blocks\n", (Failures == 0) ? "ok  " : "FAIL");
+
+  for (index = 1; index < argc; index += 2)
+  {
+    TEST_Frame(argv[index], argv[index + 1]);
+  }
+
+  printf("%u failure(s)\n", Failures);
+  return (Failures == 0) ? 0 : 1;
+}
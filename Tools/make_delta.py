@@ -0,0 +1,216 @@
+#!/usr/bin/env python3
+"""Builds a delta TM_IMAGE.BIN turning the installed application into a new one.
+
+The output is a header of seven little-endian words: magic "DLT1", size and
+CRC of the installed image, size and CRC of the new image, number of sector
+records and CRC of the body, padded with 0xFF to a whole 512-byte disk
+sector. The body follows on the next sector boundary, so that it is read
+with raw multi-sector reads; the padding is not part of the body CRC. Each
+record is the offset of a
+flash sector from APPLICATION_ADDRESS and the number of bytes it holds in
+the new image, followed by the operations producing those bytes: a word
+giving a length, with bit 31 set for a copy, then for a copy the offset of
+the source bytes in the installed image, otherwise the literal bytes.
+Sectors without a record are identical in both images.
+
+The bootloader rebuilds the sectors in address order, in place, so a copy
+may only read the installed image from the start of its own sector on. The
+CRCs are the ones of the STM32 CRC unit (see compress_image.py).
+
+With --dual-slot (bootloader built with DUAL_SLOT) offsets are from the
+slot base, the installed image is the one of the booted slot and the new
+one is built for the other slot: copies may read anywhere in the installed
+image and the sectors without a record are copied from it.
+
+Before writing, the delta is applied to the old image the way the
+bootloader does and the result is compared with the new image.
+
+usage: make_delta.py installed.bin new.bin TM_IMAGE.BIN
+       make_delta.py --dual-slot slot_a.bin new_b.bin TM_IMG_B.BIN
+"""
+
+import argparse
+import os
+import struct
+import sys
+
+from compress_image import stm32_crc
+
+MAGIC = 0x31544C44  # "DLT1"
+OP_COPY = 0x80000000
+# The header takes a whole disk sector
+HEADER_SIZE = 512
+
+# STM32F407 sectors from APPLICATION_ADDRESS (sector 3) to the end of bank 1
+SECTOR_SIZES = [16 * 1024, 64 * 1024] + [128 * 1024] * 7
+# Default spare sector: sector 11
+SPARE_OFFSET = sum(SECTOR_SIZES[:-1])
+# DUAL_SLOT: three 128 KB sectors per slot
+SLOT_SECTOR_SIZES = [128 * 1024] * 3
+
+# Bytes compared to find a match, and shortest copy worth an 8-byte operation
+KEY_SIZE = 16
+MIN_COPY = 12
+# Source positions indexed: one in INDEX_STEP
+INDEX_STEP = 4
+
+
+def sectors(size, sector_sizes):
+    start = 0
+    for length in sector_sizes:
+        if start >= size:
+            break
+        yield start, min(start + length, size)
+        start += length
+
+
+def build_index(source):
+    index = {}
+    for pos in range(0, len(source) - KEY_SIZE + 1, INDEX_STEP):
+        index.setdefault(source[pos:pos + KEY_SIZE], []).append(pos)
+    return index
+
+
+def match_length(source, target, src, dst, end):
+    length = 0
+    while dst + length < end and src + length < len(source) and \
+            source[src + length] == target[dst + length]:
+        length += 1
+    return length
+
+
+def encode_sector(source, target, index, start, end, low):
+    """Returns the operations producing target[start:end] from source bytes
+    located at low or later."""
+    ops = bytearray()
+    literal = bytearray()
+    shift = 0
+    pos = start
+
+    def flush_literal():
+        if literal:
+            ops.extend(struct.pack("<I", len(literal)) + literal)
+            literal.clear()
+
+    while pos < end:
+        best_length = 0
+        best_src = 0
+        # Same displacement as the last copy first, then the index
+        candidates = [pos + shift]
+        key = target[pos:pos + KEY_SIZE]
+        if len(key) == KEY_SIZE:
+            candidates += reversed(index.get(bytes(key), [])[-8:])
+        for src in candidates:
+            if src < low or src >= len(source):
+                continue
+            length = match_length(source, target, src, pos, end)
+            if length > best_length:
+                best_length, best_src = length, src
+
+        if best_length < MIN_COPY:
+            literal.append(target[pos])
+            pos += 1
+            continue
+
+        # Grow the match backwards over the pending literals
+        dst = pos
+        while literal and best_src > low and source[best_src - 1] == literal[-1]:
+            literal.pop()
+            best_src -= 1
+            best_length += 1
+            dst -= 1
+        flush_literal()
+        ops.extend(struct.pack("<II", best_length | OP_COPY, best_src))
+        shift = best_src - dst
+        pos = dst + best_length
+    flush_literal()
+    return bytes(ops)
+
+
+def make_delta(source, target, limit, dual_slot):
+    if len(source) > limit or len(target) > limit:
+        sys.exit("an image is larger than 0x%x bytes" % limit)
+
+    index = build_index(source)
+    body = bytearray()
+    records = 0
+    for start, end in sectors(len(target), SLOT_SECTOR_SIZES if dual_slot else SECTOR_SIZES):
+        if end <= len(source) and source[start:end] == target[start:end]:
+            continue
+        body += struct.pack("<II", start, end - start)
+        body += encode_sector(source, target, index, start, end, 0 if dual_slot else start)
+        records += 1
+
+    header = struct.pack("<7I", MAGIC, len(source), stm32_crc(source), len(target),
+                         stm32_crc(target), records, stm32_crc(bytes(body)))
+    return header + b"\xff" * (HEADER_SIZE - len(header)) + bytes(body)
+
+
+def apply_delta(source, delta, limit, dual_slot):
+    """Applies a delta the way the bootloader does. The flash past the old
+    image, or the whole other slot, holds random bytes: the delta must not
+    depend on them."""
+    magic, source_size, _, target_size, _, records, _ = struct.unpack_from("<7I", delta)
+    assert magic == MAGIC and source_size == len(source)
+    if dual_slot:
+        flash = bytearray(os.urandom(limit))
+    else:
+        flash = bytearray(source) + bytearray(os.urandom(limit - len(source)))
+    copied = 0
+    pos = HEADER_SIZE
+    for _ in range(records):
+        start, length = struct.unpack_from("<II", delta, pos)
+        pos += 8
+        if dual_slot:
+            flash[copied:start] = source[copied:start]
+        content = bytearray()
+        while len(content) < length:
+            (op,) = struct.unpack_from("<I", delta, pos)
+            pos += 4
+            size = op & ~OP_COPY
+            if op & OP_COPY:
+                (src,) = struct.unpack_from("<I", delta, pos)
+                pos += 4
+                assert (dual_slot or src >= start) and src + size <= source_size
+                content += (source if dual_slot else flash)[src:src + size]
+            else:
+                content += delta[pos:pos + size]
+                pos += size
+        assert len(content) == length
+        flash[start:start + length] = content
+        copied = start + length
+    if dual_slot:
+        flash[copied:target_size] = source[copied:target_size]
+    assert pos == len(delta)
+    return bytes(flash[:target_size])
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("installed", help="image currently in the units")
+    parser.add_argument("new", help="new image")
+    parser.add_argument("output", help="delta file to copy to the stick")
+    parser.add_argument("--spare-offset", type=lambda x: int(x, 0), default=SPARE_OFFSET,
+                        help="offset of DELTA_SPARE_ADDRESS from APPLICATION_ADDRESS")
+    parser.add_argument("--dual-slot", action="store_true",
+                        help="bootloader built with DUAL_SLOT")
+    args = parser.parse_args()
+    limit = sum(SLOT_SECTOR_SIZES) if args.dual_slot else args.spare_offset
+
+    with open(args.installed, "rb") as f:
+        source = f.read()
+    with open(args.new, "rb") as f:
+        target = f.read()
+
+    delta = make_delta(source, target, limit, args.dual_slot)
+    if apply_delta(source, delta, limit, args.dual_slot) != target:
+        sys.exit("internal error: the delta does not rebuild the new image")
+
+    with open(args.output, "wb") as f:
+        f.write(delta)
+
+    print("%s: %d bytes for a %d-byte image" % (args.output, len(delta), len(target)))
+
+
+if __name__ == "__main__":
+    main()
@@ -25,11 +25,13 @@
 #include "usbh_msc.h"
 
 /* USER CODE BEGIN Includes */
-
+#include "trace_if.h"
 /* USER CODE END Includes */
 
 /* USER CODE BEGIN PV */
 /* Private variables ---------------------------------------------------------*/
+/* Host state seen by the previous MX_USB_HOST_Idle call */
+static uint32_t HostStateSnapshot = 0xFFFFFFFFU;
 
 /* USER CODE END PV */
 
@@ -97,6 +99,64 @@ void MX_USB_HOST_Process(void)
   /* USB Host Background task */
   USBH_Process(&hUsbHostFS);
 }
+
+/* USER CODE BEGIN 2 */
+/**
+  * @brief  Sleeps until the next interrupt if the host has nothing to do.
+  * @note   The host waits on interrupts only: port and URB events (see
+  *         USBH_LL_TakeEvent) and the SysTick that ends a USBH_StartDelay
+  *         deadline or a timeout. It is not idle in the class states, nor
+  *         when the previous USBH_Process call moved a state machine on:
+  *         the next step is then submitted by the following call.
+  * @note   While the port is enabled the SOF interrupt (HAL_HCD_SOF_Callback)
+  *         fires every 1 ms frame and ends the WFI too: during enumeration
+  *         the core sleeps at most one frame at a time.
+  * @retval None
+  */
+void MX_USB_HOST_Idle(void)
+{
+#if (USBH_IDLE_SLEEP == 1U)
+  uint32_t state;
+  uint8_t idle;
+
+  state = (uint32_t)hUsbHostFS.gState | ((uint32_t)hUsbHostFS.EnumState << 8) |
+          ((uint32_t)hUsbHostFS.RequestState << 16) | ((uint32_t)hUsbHostFS.Control.state << 24);
+
+  switch (hUsbHostFS.gState)
+  {
+    case HOST_IDLE:
+    case HOST_DEV_DEBOUNCE:
+    case HOST_DEV_RESET:
+    case HOST_DEV_WAIT_FOR_ATTACHMENT:
+    case HOST_ENUMERATION:
+    case HOST_ABORT_STATE:
+      idle = (state == HostStateSnapshot) ? 1U : 0U;
+      break;
+
+    default:
+      idle = 0U;
+      break;
+  }
+
+  /* A running deadline is ended by the SysTick */
+  if ((hUsbHostFS.DelayTime != 0U) &&
+      ((USBH_GetTick() - hUsbHostFS.DelayStart) < hUsbHostFS.DelayTime))
+  {
+    idle = 1U;
+  }
+  HostStateSnapshot = state;
+
+  /* Masked, an interrupt raised after the check still ends the WFI and is
+   * served once interrupts are enabled again */
+  __disable_irq();
+  if ((USBH_LL_TakeEvent() == 0U) && (idle != 0U))
+  {
+    __WFI();
+  }
+  __enable_irq();
+#endif
+}
+/* USER CODE END 2 */
 /*
  * user callback definition
  */
@@ -110,14 +170,17 @@ static void USBH_UserProcess  (USBH_HandleTypeDef *phost, uint8_t id)
 
   case HOST_USER_DISCONNECTION:
   Appli_state = APPLICATION_DISCONNECT;
+  TRACE_POINT(TRACE_USB_DISCONNECT, 0);
   break;
 
   case HOST_USER_CLASS_ACTIVE:
   Appli_state = APPLICATION_READY;
+  TRACE_POINT(TRACE_USB_CLASS_ACTIVE, 0);
   break;
 
   case HOST_USER_CONNECTION:
   Appli_state = APPLICATION_START;
+  TRACE_POINT(TRACE_USB_CONNECT, 0);
   break;
 
   default:
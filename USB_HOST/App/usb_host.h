@@ -72,6 +72,9 @@ void MX_USB_HOST_Init(void);
 
 void MX_USB_HOST_Process(void);
 
+/** @brief Sleeps until the next interrupt while the host waits on one. */
+void MX_USB_HOST_Idle(void);
+
 /**
   * @}
   */
@@ -22,6 +22,7 @@
 #include "usbh_core.h"
 
 /* USER CODE BEGIN Includes */
+#include "trace_if.h"
 
 /* USER CODE END Includes */
 
@@ -31,6 +32,15 @@
 
 /* USER CODE BEGIN PV */
 /* Private variables ---------------------------------------------------------*/
+/* Attachment detection: tick at which VBUS was switched on and whether the
+   port reported a device since then */
+static __IO uint32_t VbusOnTick = 0;
+static __IO uint8_t VbusOn = 0;
+static __IO uint8_t PortConnectSeen = 0;
+
+/* Set by the port and URB callbacks, cleared by the main loop before it
+   decides whether to sleep */
+static __IO uint8_t HostEvent = 0;
 
 /* USER CODE END PV */
 
@@ -133,6 +143,9 @@ void HAL_HCD_SOF_Callback(HCD_HandleTypeDef *hhcd)
   */
 void HAL_HCD_Connect_Callback(HCD_HandleTypeDef *hhcd)
 {
+  PortConnectSeen = 1;
+  HostEvent = 1;
+  TRACE_POINT(TRACE_USB_ATTACH, 0);
   USBH_LL_Connect(hhcd->pData);
 }
 
@@ -143,6 +156,7 @@ void HAL_HCD_Connect_Callback(HCD_HandleTypeDef *hhcd)
   */
 void HAL_HCD_Disconnect_Callback(HCD_HandleTypeDef *hhcd)
 {
+  HostEvent = 1;
   USBH_LL_Disconnect(hhcd->pData);
 }
 
@@ -155,6 +169,9 @@ void HAL_HCD_Disconnect_Callback(HCD_HandleTypeDef *hhcd)
   */
 void HAL_HCD_HC_NotifyURBChange_Callback(HCD_HandleTypeDef *hhcd, uint8_t chnum, HCD_URBStateTypeDef urb_state)
 {
+  /* Wake the main loop so the URB is handled without waiting for a tick */
+  HostEvent = 1;
+
   /* To be used with OS to sync URB state with the global state machine */
 #if (USBH_USE_OS == 1)
   USBH_LL_NotifyURBChange(hhcd->pData);
@@ -167,6 +184,8 @@ void HAL_HCD_HC_NotifyURBChange_Callback(HCD_HandleTypeDef *hhcd, uint8_t chnum,
   */
 void HAL_HCD_PortEnabled_Callback(HCD_HandleTypeDef *hhcd)
 {
+  HostEvent = 1;
+  TRACE_POINT(TRACE_USB_PORT_ENABLED, 0);
   USBH_LL_PortEnabled(hhcd->pData);
 }
 
@@ -177,6 +196,7 @@ void HAL_HCD_PortEnabled_Callback(HCD_HandleTypeDef *hhcd)
   */
 void HAL_HCD_PortDisabled_Callback(HCD_HandleTypeDef *hhcd)
 {
+  HostEvent = 1;
   USBH_LL_PortDisabled(hhcd->pData);
 }
 
@@ -304,6 +324,7 @@ USBH_StatusTypeDef USBH_LL_ResetPort(USBH_HandleTypeDef *phost)
   HAL_StatusTypeDef hal_status = HAL_OK;
   USBH_StatusTypeDef usb_status = USBH_OK;
 
+  TRACE_POINT(TRACE_USB_RESET, 0);
   hal_status = HAL_HCD_ResetPort(phost->pData);
 
   usb_status = USBH_Get_USB_Status(hal_status);
@@ -311,6 +332,30 @@ USBH_StatusTypeDef USBH_LL_ResetPort(USBH_HandleTypeDef *phost)
   return usb_status;
 }
 
+/**
+  * @brief  Starts or ends the reset of the port.
+  * @note   Unlike USBH_LL_ResetPort the call returns at once, the reset
+  *         is timed by the caller (USBH_PORT_RESET_TIME).
+  * @param  phost: Host handle
+  * @param  state: 1 to drive the reset, 0 to release it
+  * @retval Status
+  */
+USBH_StatusTypeDef USBH_LL_DriverResetPort(USBH_HandleTypeDef *phost, uint8_t state)
+{
+  HAL_StatusTypeDef hal_status = HAL_OK;
+  USBH_StatusTypeDef usb_status = USBH_OK;
+
+  if (state != 0U)
+  {
+    TRACE_POINT(TRACE_USB_RESET, 0);
+  }
+  hal_status = HAL_HCD_ResetPort2(phost->pData, state);
+
+  usb_status = USBH_Get_USB_Status(hal_status);
+
+  return usb_status;
+}
+
 /**
   * @brief  Return the last transferred packet size.
   * @param  phost: Host handle
@@ -439,7 +484,13 @@ USBH_StatusTypeDef USBH_LL_DriverVBUS(USBH_HandleTypeDef *phost, uint8_t state)
 {
 
   /* USER CODE BEGIN 0 */
-
+  /* A new attachment window starts when VBUS is switched on */
+  if (state != FALSE)
+  {
+    PortConnectSeen = 0;
+    VbusOnTick = HAL_GetTick();
+  }
+  VbusOn = state;
   /* USER CODE END 0*/
 
   if (phost->id == HOST_FS)
@@ -461,7 +512,7 @@ USBH_StatusTypeDef USBH_LL_DriverVBUS(USBH_HandleTypeDef *phost, uint8_t state)
       /* USER CODE END DRIVE_LOW_CHARGE_FOR_FS */
     }
   }
-  HAL_Delay(200);
+  USBH_StartDelay(phost, USBH_VBUS_SETTLE_TIME);
   return USBH_OK;
 }
 
@@ -522,6 +573,49 @@ void USBH_Delay(uint32_t Delay)
   HAL_Delay(Delay);
 }
 
+/**
+  * @brief  Time base of the timer states of the USB Host Library
+  * @param  None
+  * @retval Time in ms
+  */
+uint32_t USBH_GetTick(void)
+{
+  return HAL_GetTick();
+}
+
+/**
+  * @brief  Tells whether the port is known to be empty: VBUS has been on for
+  *         USBH_ATTACH_TIMEOUT without any device pulling up a data line.
+  * @note   The connect interrupt arrives within TSIGATT of VBUS when a
+  *         device is present, so the boot needs not wait any longer.
+  * @retval 1: no device, 0: device attached or still within the window
+  */
+uint8_t USBH_LL_IsPortEmpty(void)
+{
+  uint32_t hprt = *(__IO uint32_t *)((uint32_t)USB_OTG_FS + USB_OTG_HOST_PORT_BASE);
+
+  if ((VbusOn == 0) || (PortConnectSeen != 0) || ((hprt & USB_OTG_HPRT_PCSTS) != 0))
+  {
+    return 0;
+  }
+
+  return ((HAL_GetTick() - VbusOnTick) >= USBH_ATTACH_TIMEOUT) ? 1 : 0;
+}
+
+/**
+  * @brief  Returns and clears the port/URB event flag.
+  * @note   To be called with interrupts masked when the result decides
+  *         whether to sleep, so that a later event still ends the WFI.
+  * @retval 1: an event was raised since the previous call, 0: none
+  */
+uint8_t USBH_LL_TakeEvent(void)
+{
+  uint8_t event = HostEvent;
+
+  HostEvent = 0;
+  return event;
+}
+
 /**
   * @brief  Returns the USB status depending on the HAL status:
   * @param  hal_status: HAL status
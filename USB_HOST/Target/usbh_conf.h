@@ -88,6 +88,46 @@
 /*----------   -----------*/
 #define USBH_USE_OS      0U
 
+/*----------   -----------*/
+/* Time given to a device to signal its attachment once VBUS is on, in ms
+   (TSIGATT is 100 ms in USB 2.0), before the port is reported empty */
+#ifndef USBH_ATTACH_TIMEOUT
+#define USBH_ATTACH_TIMEOUT      150U
+#endif
+
+/*----------   -----------*/
+/* Enumeration waits, in ms. They are deadlines of USBH_Process
+   (USBH_StartDelay), the main loop keeps running meanwhile.
+   1: USB 2.0 minimum times: 100 ms attach debounce (TATTDB), 50 ms root
+   port reset (TDRSTR), 10 ms reset recovery (TRSTRCY), no settling time
+   after VBUS is switched on. Some sticks need longer than the
+   minimum times: validate them before enabling it.
+   0: the stock times of the library */
+#ifndef USBH_FAST_ENUM
+#define USBH_FAST_ENUM      0U
+#endif
+
+#if (USBH_FAST_ENUM == 1U)
+#define USBH_VBUS_SETTLE_TIME      0U
+#define USBH_ATTACH_DEBOUNCE_TIME      100U
+#define USBH_PORT_RESET_TIME      50U
+#define USBH_RESET_RECOVERY_TIME      10U
+#else
+#define USBH_VBUS_SETTLE_TIME      200U
+#define USBH_ATTACH_DEBOUNCE_TIME      200U
+#define USBH_PORT_RESET_TIME      100U
+#define USBH_RESET_RECOVERY_TIME      100U
+#endif
+
+/*----------   -----------*/
+/* 1: the main loop sleeps (WFI) while the host waits for a port or URB
+   interrupt or for a deadline, 0: the main loop polls without pause.
+   Once a device is connected the SOF interrupt ends the WFI every 1 ms
+   frame, so the saving is mostly before the stick is plugged in */
+#ifndef USBH_IDLE_SLEEP
+#define USBH_IDLE_SLEEP      0U
+#endif
+
 /****************************************/
 /* #define for FS and HS identification */
 #define HOST_HS 		0
@@ -173,6 +213,8 @@
   */
 
 /* Exported functions -------------------------------------------------------*/
+uint8_t USBH_LL_IsPortEmpty(void);
+uint8_t USBH_LL_TakeEvent(void);
 
 /**
   * @}